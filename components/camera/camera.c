@@ -22,6 +22,7 @@
 // WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 // See the License for the specific language governing permissions and
 // limitations under the License.
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -39,7 +40,9 @@
 #include "driver/gpio.h"
 #include "driver/periph_ctrl.h"
 #include "esp_intr_alloc.h"
+#include "esp_heap_caps.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "sensor.h"
 #include "sccb.h"
 #include "wiring.h"
@@ -56,11 +59,64 @@
 
 #define ENABLE_TEST_PATTERN CONFIG_ENABLE_TEST_PATTERN
 
+#define DMA_BUF_MAX        4095    // limited by the 12-bit lldesc_t length field
+
+#define JPEG_FB_ALIGN      1024
+#define JPEG_FB_MIN_SIZE   4096
+#define JPEG_QS_MAX        63      // coarsest ov2640 quantizer scale
+#define JPEG_QS_STEP_MAX   8       // largest QS increase of rate control per frame
+
+#ifndef CONFIG_CAMERA_DMA_COALESCE
+#define CONFIG_CAMERA_DMA_COALESCE 0
+#define CONFIG_CAMERA_DMA_COALESCE_BYTES 0
+#endif
+
+#ifndef CONFIG_CAMERA_JPEG_STOP_ON_EOI
+#define CONFIG_CAMERA_JPEG_STOP_ON_EOI 0
+#endif
+
+#ifndef CONFIG_CAMERA_DMA_PACKED
+#define CONFIG_CAMERA_DMA_PACKED 0
+#endif
+
+#ifndef CONFIG_CAMERA_SOFT_JPEG
+#define CONFIG_CAMERA_SOFT_JPEG 0
+#endif
+
+#ifndef CONFIG_CAMERA_SOFT_JPEG_420
+#define CONFIG_CAMERA_SOFT_JPEG_420 0
+#endif
+
+#ifndef CONFIG_CAMERA_JPEG_RATE_BAND
+#define CONFIG_CAMERA_JPEG_RATE_BAND 15
+#endif
+
+#ifndef CONFIG_CAMERA_JPEG_ADAPTIVE_FB
+#define CONFIG_CAMERA_JPEG_ADAPTIVE_FB 0
+#endif
+
 #define REG_PID        0x0A
 #define REG_VER        0x0B
 #define REG_MIDH       0x1C
 #define REG_MIDL       0x1D
 
+// markers passed through dma_ring in place of a DMA buffer index
+#define DMA_FRAME_END  SIZE_MAX          // frame complete
+#define DMA_FRAME_DROP (SIZE_MAX - 1)    // lines were lost, discard the frame
+
+// dma_ring slots only frame markers may take. A lost DMA_FRAME_END would
+// leave camera_run waiting forever, a lost buffer only damages a frame.
+#define DMA_RING_RESERVE 2
+
+// aux_ring slots only DMA_FRAME_END may take, so the end of a frame can
+// always be handed to dma_filter_aux_task
+#define AUX_RING_RESERVE 1
+
+// other dma_ring items: index of the first filled DMA buffer in the low
+// bits, number of filled buffers from there on above them
+#define DMA_ITEM_SHIFT 16
+#define DMA_ITEM(buf_idx, count) ((buf_idx) | ((count) << DMA_ITEM_SHIFT))
+
 static const char* TAG = "camera";
 
 camera_state_t* s_state = NULL;
@@ -85,23 +141,35 @@ static void i2s_init();
 static void i2s_run();
 static void IRAM_ATTR gpio_isr(void* arg);
 static void IRAM_ATTR i2s_isr(void* arg);
-static esp_err_t dma_desc_init();
-static void dma_desc_deinit();
+static esp_err_t arena_init();
+static void arena_deinit();
+static esp_err_t dma_desc_resize(size_t lines);
+static void dma_span_init();
+static esp_err_t fb_pool_init();
+static esp_err_t fb_pool_setup();
+static void fb_pool_deinit();
+static void stream_frame_done();
+static void fb_fit(camera_fb_t* fb);
+static void jpeg_fb_size_update(size_t frame_size, bool truncated);
+static void jpeg_rate_update(size_t frame_size, bool truncated);
 static void dma_filter_task(void *pvParameters);
-static void dma_filter_grayscale(const dma_elem_t* src, lldesc_t* dma_desc,
-		uint8_t* dst);
-static void dma_filter_grayscale_highspeed(const dma_elem_t* src,
-		lldesc_t* dma_desc, uint8_t* dst);
-static void dma_filter_jpeg(const dma_elem_t* src, lldesc_t* dma_desc,
-		uint8_t* dst);
-static void dma_filter_rgb565(const dma_elem_t* src, lldesc_t* dma_desc,
-		uint8_t* dst);
-static void i2s_stop();
+static void dma_filter_aux_task(void *pvParameters);
+static void i2s_stop(bool* need_yield);
+static void dma_ring_push(size_t item, bool* need_yield);
+static void i2s_halt();
+static void vsync_wait(int edges);
+static void frame_reset();
+static void dma_filter_run(size_t buf_idx, uint8_t* dst);
 
 static bool is_hs_mode() {
 	return s_state->config.xclk_freq_hz > 10000000;
 }
 
+// QS 0..63 of the ov2640 maps to software JPEG quality 100..5
+static int soft_jpeg_quality(int qs) {
+	return 100 - qs * 95 / JPEG_QS_MAX;
+}
+
 static size_t i2s_bytes_per_sample(i2s_sampling_mode_t mode) {
 	switch (mode) {
 	case SM_0A00_0B00:
@@ -196,42 +264,77 @@ esp_err_t camera_probe(const camera_config_t* config,
 	return ESP_OK;
 }
 
-esp_err_t camera_init(const camera_config_t* config) {
-	if (!s_state) {
-		return ESP_ERR_INVALID_STATE;
+// Software JPEG encoder for the current frame size and quality.
+static void jpeg_soft_init() {
+	// the sensor sends YUYV, encoded one strip of lines at a time
+	jpeg_enc_init(&s_state->jpeg_enc, s_state->width, s_state->height,
+			CONFIG_CAMERA_SOFT_JPEG_420 ? JPEG_ENC_YUV420 : JPEG_ENC_YUV422,
+			soft_jpeg_quality(s_state->jpeg_qs));
+}
+
+// JPEG frame buffer estimate and software encoder for the current frame
+// size. Called again whenever a window changes the size.
+static void jpeg_frame_init(int qp) {
+	int compression_ratio_bound;
+	if (qp >= 30) {
+		compression_ratio_bound = 5;
+	} else if (qp >= 10) {
+		compression_ratio_bound = 10;
+	} else {
+		compression_ratio_bound = 20;
 	}
-	if (s_state->sensor.id.PID == 0) {
-		return ESP_ERR_CAMERA_NOT_SUPPORTED;
+	size_t equiv_line_count = s_state->height / compression_ratio_bound;
+	s_state->fb_size = s_state->width * equiv_line_count * 2 /* bpp */;
+	if (s_state->jpeg_soft) {
+		jpeg_soft_init();
 	}
-	memcpy(&s_state->config, config, sizeof(*config));
-	esp_err_t err = ESP_OK;
+	// sizes seen at another frame size say nothing about this one
+	s_state->jpeg_hist_pos = 0;
+	s_state->jpeg_hist_count = 0;
+}
+
+// Frame geometry, sampling mode and filters for a configuration. Only
+// touches the driver state, the sensor is programmed by sensor_apply.
+static esp_err_t frame_format_init(const camera_config_t* config) {
 	framesize_t frame_size = (framesize_t) config->frame_size;
 	pixformat_t pix_format = (pixformat_t) config->pixel_format;
-	s_state->width = resolution[frame_size][0];
-	s_state->height = resolution[frame_size][1];
-	s_state->sensor.set_pixformat(&s_state->sensor, pix_format);
-
-	ESP_LOGD(TAG, "Setting frame size to %dx%d", s_state->width,
-			s_state->height);
-	if (s_state->sensor.set_framesize(&s_state->sensor, frame_size) != 0) {
-		ESP_LOGE(TAG, "Failed to set frame size");
-		err = ESP_ERR_CAMERA_FAILED_TO_SET_FRAME_SIZE;
-		goto fail;
+	s_state->sensor_width = resolution[frame_size][0];
+	s_state->sensor_height = resolution[frame_size][1];
+	s_state->roi_x = 0;
+	s_state->roi_y = 0;
+	s_state->jpeg_soft = false;
+	s_state->jpeg_target = 0;
+	s_state->decimation = (config->decimation > 1) ? config->decimation : 1;
+	s_state->decim_box = (s_state->decimation > 1
+			&& config->decimation_mode == CAMERA_DECIMATE_BOX);
+	if (s_state->decimation != 1 && s_state->decimation != 2
+			&& s_state->decimation != 4) {
+		ESP_LOGE(TAG, "Decimation has to be 2 or 4");
+		return ESP_ERR_INVALID_ARG;
+	}
+	if ((s_state->decimation > 1 && pix_format != PIXFORMAT_GRAYSCALE
+			&& pix_format != PIXFORMAT_RGB565)
+			|| (s_state->decim_box && pix_format != PIXFORMAT_GRAYSCALE)) {
+		ESP_LOGE(TAG, "Decimation is not supported for this format");
+		return ESP_ERR_NOT_SUPPORTED;
+	}
+	s_state->width = s_state->sensor_width / s_state->decimation;
+	s_state->height = s_state->sensor_height / s_state->decimation;
+	s_state->pyramid_levels = (config->pyramid_levels > 0) ?
+			config->pyramid_levels : 0;
+	if (s_state->pyramid_levels > CAMERA_PYRAMID_LEVELS_MAX) {
+		ESP_LOGE(TAG, "At most %d pyramid levels are supported",
+				CAMERA_PYRAMID_LEVELS_MAX);
+		return ESP_ERR_INVALID_ARG;
+	}
+	if (s_state->pyramid_levels > 0 && (pix_format != PIXFORMAT_GRAYSCALE
+			|| config->fb_disabled)) {
+		ESP_LOGE(TAG, "Pyramid levels need a grayscale frame buffer");
+		return ESP_ERR_NOT_SUPPORTED;
 	}
-	s_state->sensor.set_pixformat(&s_state->sensor, pix_format);
-
-	s_state->sensor.set_whitebal(&s_state->sensor, 0);
-
-#if ENABLE_TEST_PATTERN
-	/* Test pattern may get handy
-	 if you are unable to get the live image right.
-	 Once test pattern is enable, sensor will output
-	 vertical shaded bars instead of live image.
-	 */
-	s_state->sensor.set_colorbar(&s_state->sensor, 1);
-	ESP_LOGD(TAG, "Test pattern enabled");
-#endif
 
+	dma_filter_layout_t filter_layout;
+	bool planar = false;
 	if (pix_format == PIXFORMAT_GRAYSCALE) {
 //		if (s_state->sensor.id.PID != OV7725_PID) {
 //			ESP_LOGE(TAG, "Grayscale format is only supported for ov7225");
@@ -241,11 +344,10 @@ esp_err_t camera_init(const camera_config_t* config) {
 		s_state->fb_size = s_state->width * s_state->height;
 		if (is_hs_mode()) {
 			s_state->sampling_mode = SM_0A0B_0B0C;
-			s_state->dma_filter = &dma_filter_grayscale_highspeed;
 		} else {
 			s_state->sampling_mode = SM_0A0B_0C0D;
-			s_state->dma_filter = &dma_filter_grayscale;
 		}
+		filter_layout = DMA_FILTER_Y8;
 		s_state->in_bytes_per_pixel = 2;       // camera sends YUYV
 		s_state->fb_bytes_per_pixel = 1;       // frame buffer stores Y8
 	} else if (pix_format == PIXFORMAT_RGB565) {
@@ -254,46 +356,99 @@ esp_err_t camera_init(const camera_config_t* config) {
 //			err = ESP_ERR_NOT_SUPPORTED;
 //			goto fail;
 //		}
-		s_state->fb_size = s_state->width * s_state->height * 3;
 		if (is_hs_mode()) {
 			s_state->sampling_mode = SM_0A0B_0B0C;
+		} else if (CONFIG_CAMERA_DMA_PACKED) {
+			s_state->sampling_mode = SM_0A0B_0C0D;
 		} else {
 			s_state->sampling_mode = SM_0A00_0B00;
 		}
 		s_state->in_bytes_per_pixel = 2;       // camera sends RGB565 (2 bytes)
-		s_state->fb_bytes_per_pixel = 3;       // frame buffer stores RGB888
-		s_state->dma_filter = &dma_filter_rgb565;
+		switch (config->fb_layout) {
+		case CAMERA_FB_LAYOUT_DEFAULT:
+		case CAMERA_FB_LAYOUT_BGR888:
+			s_state->fb_bytes_per_pixel = 3;
+			filter_layout = DMA_FILTER_BGR888;
+			break;
+		case CAMERA_FB_LAYOUT_RGB888:
+			s_state->fb_bytes_per_pixel = 3;
+			filter_layout = DMA_FILTER_RGB888;
+			break;
+		case CAMERA_FB_LAYOUT_RGB565_BE:
+			s_state->fb_bytes_per_pixel = 2;
+			filter_layout = DMA_FILTER_RGB565_BE;
+			break;
+		case CAMERA_FB_LAYOUT_RGB565_LE:
+			s_state->fb_bytes_per_pixel = 2;
+			filter_layout = DMA_FILTER_RGB565_LE;
+			break;
+		default:
+			ESP_LOGE(TAG, "Requested frame buffer layout is not supported");
+			return ESP_ERR_NOT_SUPPORTED;
+		}
+		s_state->fb_size = s_state->width * s_state->height
+				* s_state->fb_bytes_per_pixel;
 
+	} else if (pix_format == PIXFORMAT_YUV422) {
+		if (is_hs_mode()) {
+			s_state->sampling_mode = SM_0A0B_0B0C;
+		} else {
+			s_state->sampling_mode = SM_0A0B_0C0D;
+		}
+		s_state->in_bytes_per_pixel = 2;       // camera sends YUYV
+		if (config->fb_layout == CAMERA_FB_LAYOUT_DEFAULT) {
+			s_state->fb_bytes_per_pixel = 2;   // frame buffer stores YUYV
+			s_state->fb_size = s_state->width * s_state->height * 2;
+			filter_layout = DMA_FILTER_RAW;
+		} else if (config->fb_layout == CAMERA_FB_LAYOUT_I420) {
+			if (config->line_cb != NULL) {
+				ESP_LOGE(TAG, "Line callback is not supported for I420");
+				return ESP_ERR_NOT_SUPPORTED;
+			}
+			// fb position follows the Y plane, U and V planes come after it
+			s_state->fb_bytes_per_pixel = 1;
+			s_state->fb_size = s_state->width * s_state->height * 3 / 2;
+			// chroma is taken from even lines, odd lines only carry luma
+			filter_layout = DMA_FILTER_Y8;
+			planar = true;
+		} else {
+			ESP_LOGE(TAG, "Requested frame buffer layout is not supported");
+			return ESP_ERR_NOT_SUPPORTED;
+		}
 	} else if (pix_format == PIXFORMAT_JPEG) {
-		if (s_state->sensor.id.PID != OV2640_PID) {
+		s_state->jpeg_soft = (s_state->sensor.id.PID != OV2640_PID);
+		if (s_state->jpeg_soft && !CONFIG_CAMERA_SOFT_JPEG) {
 			ESP_LOGE(TAG, "JPEG format is only supported for ov2640");
-			err = ESP_ERR_NOT_SUPPORTED;
-			goto fail;
+			return ESP_ERR_NOT_SUPPORTED;
 		}
 		int qp = config->jpeg_quality;
-		int compression_ratio_bound;
-		if (qp >= 30) {
-			compression_ratio_bound = 5;
-		} else if (qp >= 10) {
-			compression_ratio_bound = 10;
-		} else {
-			compression_ratio_bound = 20;
-		}
-		(*s_state->sensor.set_quality)(&s_state->sensor, qp);
-		size_t equiv_line_count = s_state->height / compression_ratio_bound;
-		s_state->fb_size = s_state->width * equiv_line_count * 2 /* bpp */;
-		s_state->dma_filter = &dma_filter_jpeg;
+		s_state->jpeg_qs = (qp < 0) ? 0 : (qp > JPEG_QS_MAX) ? JPEG_QS_MAX : qp;
+		s_state->jpeg_target = config->jpeg_target_size;
+		s_state->jpeg_rate_hold = 0;
+		filter_layout = DMA_FILTER_RAW;
 		if (is_hs_mode()) {
 			s_state->sampling_mode = SM_0A0B_0B0C;
+		} else if (CONFIG_CAMERA_DMA_PACKED || s_state->jpeg_soft) {
+			s_state->sampling_mode = SM_0A0B_0C0D;
 		} else {
 			s_state->sampling_mode = SM_0A00_0B00;
 		}
+		jpeg_frame_init(qp);
 		s_state->in_bytes_per_pixel = 2;
 		s_state->fb_bytes_per_pixel = 2;
 	} else {
 		ESP_LOGE(TAG, "Requested format is not supported");
-		err = ESP_ERR_NOT_SUPPORTED;
-		goto fail;
+		return ESP_ERR_NOT_SUPPORTED;
+	}
+
+	s_state->dma_filter = dma_filter_get(s_state->sampling_mode, filter_layout,
+			s_state->decimation, s_state->decim_box);
+	s_state->dma_filter_planar = planar ?
+			dma_filter_planar_get(s_state->sampling_mode) : NULL;
+	if (s_state->dma_filter == NULL
+			|| (planar && s_state->dma_filter_planar == NULL)) {
+		ESP_LOGE(TAG, "Requested format is disabled in menuconfig");
+		return ESP_ERR_NOT_SUPPORTED;
 	}
 
 	ESP_LOGD(TAG,
@@ -302,25 +457,139 @@ esp_err_t camera_init(const camera_config_t* config) {
 			s_state->fb_size, s_state->sampling_mode, s_state->width,
 			s_state->height);
 
-	ESP_LOGD(TAG, "Allocating frame buffer (%d bytes)", s_state->fb_size);
-	s_state->fb = (uint8_t*) calloc(s_state->fb_size, 1);
-	if (s_state->fb == NULL) {
-		ESP_LOGE(TAG, "Failed to allocate frame buffer");
-		err = ESP_ERR_NO_MEM;
+	if (config->line_cb != NULL && pix_format == PIXFORMAT_JPEG) {
+		ESP_LOGE(TAG, "Line callback is not supported for JPEG");
+		return ESP_ERR_NOT_SUPPORTED;
+	}
+	return ESP_OK;
+}
+
+// Program the sensor for a configuration. With prev set, only settings
+// which differ from prev are written.
+static esp_err_t sensor_apply(const camera_config_t* config,
+		const camera_config_t* prev) {
+	framesize_t frame_size = (framesize_t) config->frame_size;
+	pixformat_t pix_format = (pixformat_t) config->pixel_format;
+	if (s_state->jpeg_soft) {
+		pix_format = PIXFORMAT_YUV422;
+	}
+	// a sensor window replaces the frame size, take it back first
+	bool size_changed = (prev == NULL || prev->frame_size != config->frame_size
+			|| s_state->sensor_windowed);
+	bool format_changed = (prev == NULL
+			|| prev->pixel_format != config->pixel_format);
+	if (prev == NULL) {
+		s_state->sensor.set_pixformat(&s_state->sensor, pix_format);
+	}
+	if (size_changed) {
+		ESP_LOGD(TAG, "Setting frame size to %dx%d", s_state->sensor_width,
+				s_state->sensor_height);
+		if (s_state->sensor.set_framesize(&s_state->sensor, frame_size) != 0) {
+			ESP_LOGE(TAG, "Failed to set frame size");
+			return ESP_ERR_CAMERA_FAILED_TO_SET_FRAME_SIZE;
+		}
+		if (s_state->sensor_windowed) {
+			s_state->sensor.set_window(&s_state->sensor, 0, 0,
+					s_state->sensor_width, s_state->sensor_height);
+			s_state->sensor_windowed = false;
+		}
+	}
+	if (size_changed || format_changed) {
+		s_state->sensor.set_pixformat(&s_state->sensor, pix_format);
+	}
+
+	if (prev == NULL) {
+		s_state->sensor.set_whitebal(&s_state->sensor, 0);
+
+#if ENABLE_TEST_PATTERN
+		/* Test pattern may get handy
+		 if you are unable to get the live image right.
+		 Once test pattern is enable, sensor will output
+		 vertical shaded bars instead of live image.
+		 */
+		s_state->sensor.set_colorbar(&s_state->sensor, 1);
+		ESP_LOGD(TAG, "Test pattern enabled");
+#endif
+	}
+
+	// software JPEG takes its quality from frame_format_init; rate control
+	// may have moved QS away from jpeg_quality
+	if (pix_format == PIXFORMAT_JPEG && (format_changed
+			|| prev->jpeg_quality != config->jpeg_quality
+			|| prev->jpeg_target_size != 0)) {
+		(*s_state->sensor.set_quality)(&s_state->sensor, s_state->jpeg_qs);
+	}
+	return ESP_OK;
+}
+
+static bool dual_filter_allowed() {
+#if CONFIG_CAMERA_DUAL_CORE_FILTER
+	// JPEG data has to be scanned for markers in order, keep it on one core.
+	// Lines passed to line_cb have to be complete, keep them on one core too.
+	// Box decimation sums up lines in order, on one core as well.
+	// Pyramid levels are computed from pairs of complete lines.
+	return (s_state->config.pixel_format != CAMERA_PF_JPEG
+			&& s_state->config.line_cb == NULL && !s_state->decim_box
+			&& s_state->pyramid_levels == 0);
+#else
+	return false;
+#endif
+}
+
+esp_err_t camera_init(const camera_config_t* config) {
+	if (!s_state) {
+		return ESP_ERR_INVALID_STATE;
+	}
+	if (s_state->sensor.id.PID == 0) {
+		return ESP_ERR_CAMERA_NOT_SUPPORTED;
+	}
+	memcpy(&s_state->config, config, sizeof(*config));
+	esp_err_t err = frame_format_init(config);
+	if (err != ESP_OK) {
+		goto fail;
+	}
+	err = sensor_apply(config, NULL);
+	if (err != ESP_OK) {
+		goto fail;
+	}
+	if (config->fb_disabled) {
+		if (config->line_cb == NULL) {
+			ESP_LOGE(TAG, "Line callback is required without frame buffer");
+			err = ESP_ERR_INVALID_ARG;
+			goto fail;
+		}
+	} else {
+		s_state->fb_count = (config->fb_count > 1) ? config->fb_count : 1;
+		err = fb_pool_init();
+		if (err != ESP_OK) {
+			ESP_LOGE(TAG, "Failed to create frame buffer pool");
+			goto fail;
+		}
+	}
+
+	s_state->dual_filter = dual_filter_allowed();
+
+	s_state->dma_lines = (config->dma_lines > 0) ?
+			config->dma_lines : CONFIG_CAMERA_DMA_LINES;
+	s_state->dma_buf_max = (config->dma_buf_max > 0) ?
+			config->dma_buf_max : CONFIG_CAMERA_DMA_BUF_MAX;
+	if (s_state->dma_lines < 2 || s_state->dma_buf_max > DMA_BUF_MAX) {
+		ESP_LOGE(TAG, "Invalid DMA ring configuration");
+		err = ESP_ERR_INVALID_ARG;
 		goto fail;
 	}
 
 	ESP_LOGD(TAG, "Initializing I2S and DMA");
 	i2s_init();
-	err = dma_desc_init();
+	err = arena_init();
 	if (err != ESP_OK) {
 		ESP_LOGE(TAG, "Failed to initialize I2S and DMA");
 		goto fail;
 	}
 
-	s_state->data_ready = xQueueCreate(16, sizeof(size_t));
 	s_state->frame_ready = xSemaphoreCreateBinary();
-	if (s_state->data_ready == NULL || s_state->frame_ready == NULL) {
+	s_state->vsync_sem = xSemaphoreCreateBinary();
+	if (s_state->frame_ready == NULL || s_state->vsync_sem == NULL) {
 		ESP_LOGE(TAG, "Failed to create semaphores");
 		err = ESP_ERR_NO_MEM;
 		goto fail;
@@ -331,12 +600,25 @@ esp_err_t camera_init(const camera_config_t* config) {
 		err = ESP_ERR_NO_MEM;
 		goto fail;
 	}
+	if (s_state->dual_filter) {
+		s_state->aux_done = xSemaphoreCreateBinary();
+		if (s_state->aux_done == NULL
+				|| !xTaskCreatePinnedToCore(&dma_filter_aux_task,
+						"dma_filter_aux", 2048, NULL, 10,
+						&s_state->dma_filter_aux_task, 0)) {
+			ESP_LOGE(TAG, "Failed to create auxiliary DMA filter task");
+			err = ESP_ERR_NO_MEM;
+			goto fail;
+		}
+	}
 
 	ESP_LOGD(TAG, "Initializing GPIO interrupts");
 	gpio_set_intr_type(s_state->config.pin_vsync, GPIO_INTR_NEGEDGE);
 	gpio_intr_enable(s_state->config.pin_vsync);
+	// same level as the I2S interrupt, and allocated from the same task so
+	// on the same core: the two producers of dma_ring never nest
 	err = gpio_isr_register(&gpio_isr, (void*) TAG,
-	ESP_INTR_FLAG_INTRDISABLED | ESP_INTR_FLAG_IRAM,
+	ESP_INTR_FLAG_INTRDISABLED | ESP_INTR_FLAG_LEVEL1 | ESP_INTR_FLAG_IRAM,
 			&s_state->vsync_intr_handle);
 	if (err != ESP_OK) {
 		ESP_LOGE(TAG, "gpio_isr_register failed (%x)", err);
@@ -344,15 +626,8 @@ esp_err_t camera_init(const camera_config_t* config) {
 	}
 
 	// skip at least one frame after changing camera settings
-	while (gpio_get_level(s_state->config.pin_vsync) == 0) {
-		;
-	}
-	while (gpio_get_level(s_state->config.pin_vsync) != 0) {
-		;
-	}
-	while (gpio_get_level(s_state->config.pin_vsync) == 0) {
-		;
-	}
+	vsync_wait(2);
+	esp_intr_disable(s_state->vsync_intr_handle);
 	s_state->frame_count = 0;
 	ESP_LOGD(TAG, "Init done");
 	return ESP_OK;
@@ -368,12 +643,18 @@ esp_err_t camera_deinit() {
 	if (s_state->dma_filter_task) {
 		vTaskDelete(s_state->dma_filter_task);
 	}
-	if (s_state->data_ready) {
-		vQueueDelete(s_state->data_ready);
+	if (s_state->dma_filter_aux_task) {
+		vTaskDelete(s_state->dma_filter_aux_task);
+	}
+	if (s_state->aux_done) {
+		vSemaphoreDelete(s_state->aux_done);
 	}
 	if (s_state->frame_ready) {
 		vSemaphoreDelete(s_state->frame_ready);
 	}
+	if (s_state->vsync_sem) {
+		vSemaphoreDelete(s_state->vsync_sem);
+	}
 	if (s_state->vsync_intr_handle) {
 		esp_intr_disable(s_state->vsync_intr_handle);
 		esp_intr_free(s_state->vsync_intr_handle);
@@ -382,8 +663,8 @@ esp_err_t camera_deinit() {
 		esp_intr_disable(s_state->i2s_intr_handle);
 		esp_intr_free(s_state->i2s_intr_handle);
 	}
-	dma_desc_deinit();
-	free(s_state->fb);
+	arena_deinit();
+	fb_pool_deinit();
 	free(s_state);
 	s_state = NULL;
 	camera_disable_out_clock();
@@ -412,6 +693,14 @@ int camera_get_fb_height() {
 	return s_state->height;
 }
 
+uint8_t* camera_get_pyramid(int level) {
+	if (s_state == NULL || s_state->fb_cur == NULL || level < 1
+			|| level > s_state->pyramid_levels) {
+		return NULL;
+	}
+	return s_state->fb_cur->pyramid[level - 1];
+}
+
 size_t camera_get_data_size() {
 	if (s_state == NULL) {
 		return 0;
@@ -420,14 +709,19 @@ size_t camera_get_data_size() {
 }
 
 esp_err_t camera_run() {
-	if (s_state == NULL) {
+	if (s_state == NULL || s_state->streaming || s_state->arena == NULL) {
 		return ESP_ERR_INVALID_STATE;
 	}
-	struct timeval tv_start;
-	gettimeofday(&tv_start, NULL);
+	camera_fb_t* fb = s_state->fb_cur;
+	if (fb != NULL) {
+		fb_fit(fb);
+		s_state->fb = fb->buf;
 #ifndef _NDEBUG
-	memset(s_state->fb, 0, s_state->fb_size);
+		memset(s_state->fb, 0, fb->size);
 #endif // _NDEBUG
+	}
+	struct timeval tv_start;
+	gettimeofday(&tv_start, NULL);
 	i2s_run();
 	ESP_LOGD(TAG, "Waiting for frame");
 	xSemaphoreTake(s_state->frame_ready, portMAX_DELAY);
@@ -436,77 +730,950 @@ esp_err_t camera_run() {
 	int time_ms = (tv_end.tv_sec - tv_start.tv_sec) * 1000
 			+ (tv_end.tv_usec - tv_start.tv_usec) / 1000;
 	ESP_LOGI(TAG, "Frame %d done in %d ms", s_state->frame_count, time_ms);
+	if (fb == NULL) {
+		s_state->frame_count++;
+		return ESP_OK;
+	}
+	fb->seq = s_state->frame_count;
 	s_state->frame_count++;
+	if (fb->truncated) {
+		return ESP_ERR_CAMERA_FRAME_TRUNCATED;
+	}
+	return ESP_OK;
+}
+
+esp_err_t camera_stream_start() {
+	if (s_state == NULL || s_state->streaming || s_state->arena == NULL) {
+		return ESP_ERR_INVALID_STATE;
+	}
+	if (s_state->fb_count < 2 && !s_state->config.fb_disabled) {
+		ESP_LOGE(TAG, "Streaming needs at least 2 frame buffers");
+		return ESP_ERR_NOT_SUPPORTED;
+	}
+	s_state->streaming = true;
+#if CONFIG_CAMERA_FREE_RUNNING
+	s_state->free_running = true;
+#endif
+	i2s_run();
 	return ESP_OK;
 }
 
-static esp_err_t dma_desc_init() {
-	assert(s_state->width % 4 == 0);
-	size_t line_size = s_state->width * s_state->in_bytes_per_pixel
+esp_err_t camera_stream_stop() {
+	if (s_state == NULL || !s_state->streaming) {
+		return ESP_ERR_INVALID_STATE;
+	}
+	s_state->streaming = false;
+	// filter task stops re-arming DMA and signals once the frame in flight is done
+	xSemaphoreTake(s_state->frame_ready, portMAX_DELAY);
+	return ESP_OK;
+}
+
+camera_fb_t* camera_fb_get(uint32_t timeout_ms) {
+	if (s_state == NULL || s_state->fb_queue.filled == NULL) {
+		return NULL;
+	}
+	return (camera_fb_t*) fb_queue_get(&s_state->fb_queue,
+			pdMS_TO_TICKS(timeout_ms));
+}
+
+void camera_fb_return(camera_fb_t* fb) {
+	if (s_state == NULL || s_state->fb_queue.free == NULL || fb == NULL) {
+		return;
+	}
+	fb_queue_release(&s_state->fb_queue, fb);
+}
+
+// Frame format and geometry, everything frame_format_init, the window,
+// the region of interest and the DMA ring depth decide. Saved before a
+// change, so that a failed change can go back to what worked.
+typedef struct {
+	camera_config_t config;
+	size_t width;
+	size_t height;
+	size_t sensor_width;
+	size_t sensor_height;
+	bool sensor_windowed;
+	size_t window_x;
+	size_t window_y;
+	size_t roi_x;
+	size_t roi_y;
+	size_t decimation;
+	bool decim_box;
+	size_t pyramid_levels;
+	size_t in_bytes_per_pixel;
+	size_t fb_bytes_per_pixel;
+	size_t fb_size;
+	i2s_sampling_mode_t sampling_mode;
+	dma_filter_t dma_filter;
+	dma_filter_planar_t dma_filter_planar;
+	bool dual_filter;
+	size_t dma_lines;
+	bool jpeg_soft;
+	int jpeg_qs;
+	size_t jpeg_target;
+	size_t jpeg_rate_hold;
+} geometry_t;
+
+#define GEOMETRY_FIELDS(X) X(config) X(width) X(height) X(sensor_width) \
+	X(sensor_height) X(sensor_windowed) X(window_x) X(window_y) X(roi_x) \
+	X(roi_y) X(decimation) X(decim_box) X(pyramid_levels) \
+	X(in_bytes_per_pixel) X(fb_bytes_per_pixel) X(fb_size) X(sampling_mode) \
+	X(dma_filter) X(dma_filter_planar) X(dual_filter) X(dma_lines) \
+	X(jpeg_soft) X(jpeg_qs) X(jpeg_target) X(jpeg_rate_hold)
+
+static void geometry_save(geometry_t* g) {
+#define SAVE_FIELD(f) g->f = s_state->f;
+	GEOMETRY_FIELDS(SAVE_FIELD)
+#undef SAVE_FIELD
+}
+
+// Go back to a saved geometry after a failed change. applied is the
+// configuration the sensor was last programmed with, NULL if the change
+// did not get as far as the sensor. With rebuild set, capture memory is
+// laid out again; otherwise the change must not have touched it.
+static esp_err_t geometry_restore(const geometry_t* g,
+		const camera_config_t* applied, bool rebuild) {
+	// whether the sensor still has a window, sensor_apply resets it
+	bool windowed = s_state->sensor_windowed;
+#define LOAD_FIELD(f) s_state->f = g->f;
+	GEOMETRY_FIELDS(LOAD_FIELD)
+#undef LOAD_FIELD
+	if (s_state->jpeg_soft) {
+		jpeg_soft_init();
+	}
+	s_state->jpeg_hist_pos = 0;
+	s_state->jpeg_hist_count = 0;
+	I2S0.fifo_conf.rx_fifo_mod = s_state->sampling_mode;
+	esp_err_t err = ESP_OK;
+	if (applied != NULL) {
+		// program the full frame first, then the window on top of it
+		s_state->sensor_windowed = windowed;
+		s_state->sensor_width = resolution[g->config.frame_size][0];
+		s_state->sensor_height = resolution[g->config.frame_size][1];
+		err = sensor_apply(&g->config, applied);
+		s_state->sensor_width = g->sensor_width;
+		s_state->sensor_height = g->sensor_height;
+		if (err == ESP_OK && g->sensor_windowed
+				&& s_state->sensor.set_window(&s_state->sensor, g->window_x,
+						g->window_y, g->sensor_width, g->sensor_height) != 0) {
+			err = ESP_ERR_CAMERA_FAILED_TO_SET_FRAME_SIZE;
+		}
+		s_state->sensor_windowed = g->sensor_windowed;
+		if (err != ESP_OK) {
+			ESP_LOGE(TAG, "Failed to restore sensor settings");
+		}
+		vsync_wait(2);
+		esp_intr_disable(s_state->vsync_intr_handle);
+	}
+	if (rebuild) {
+		esp_err_t mem_err = arena_init();
+		if (mem_err != ESP_OK) {
+			ESP_LOGE(TAG, "Failed to restore capture memory");
+			err = mem_err;
+		}
+	}
+	return err;
+}
+
+esp_err_t camera_set_roi(int x, int y, int w, int h) {
+	if (s_state == NULL || s_state->streaming) {
+		return ESP_ERR_INVALID_STATE;
+	}
+	if (w == 0 || h == 0) {
+		x = 0;
+		y = 0;
+		w = s_state->sensor_width;
+		h = s_state->sensor_height;
+	}
+	if (x < 0 || y < 0 || w < 0 || h < 0 || x + w > s_state->sensor_width
+			|| y + h > s_state->sensor_height) {
+		return ESP_ERR_INVALID_ARG;
+	}
+	bool full_frame = (w == s_state->sensor_width
+			&& h == s_state->sensor_height);
+	if (!full_frame && (s_state->config.pixel_format == CAMERA_PF_JPEG
+			|| s_state->dma_filter_planar != NULL
+			|| s_state->decimation > 1)) {
+		ESP_LOGE(TAG, "Region of interest is not supported for this format");
+		return ESP_ERR_NOT_SUPPORTED;
+	}
+	if (s_state->config.pixel_format == CAMERA_PF_YUV422
+			&& ((x | w) & 1) != 0) {
+		// YUYV is sent in pixel pairs
+		return ESP_ERR_INVALID_ARG;
+	}
+	ESP_LOGD(TAG, "Region of interest: %dx%d at %d,%d", w, h, x, y);
+	geometry_t prev;
+	geometry_save(&prev);
+	s_state->roi_x = x;
+	s_state->roi_y = y;
+	s_state->width = w / s_state->decimation;
+	s_state->height = h / s_state->decimation;
+	if (s_state->config.pixel_format == CAMERA_PF_JPEG) {
+		// a window changes the JPEG size estimate, and the software
+		// encoder and its strip have to match the new frame size
+		jpeg_frame_init(s_state->config.jpeg_quality);
+	} else {
+		s_state->fb_size = s_state->width * s_state->fb_bytes_per_pixel
+				* s_state->height;
+	}
+	// frame buffers shrink or grow to the region
+	esp_err_t err = arena_init();
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "Failed to allocate capture memory");
+		geometry_restore(&prev, NULL, true);
+	}
+	return err;
+}
+
+esp_err_t camera_set_window(int x, int y, int w, int h) {
+	if (s_state == NULL || s_state->streaming) {
+		return ESP_ERR_INVALID_STATE;
+	}
+	if (s_state->sensor.set_window == NULL) {
+		return ESP_ERR_NOT_SUPPORTED;
+	}
+	int frame_width = resolution[s_state->config.frame_size][0];
+	int frame_height = resolution[s_state->config.frame_size][1];
+	if (w == 0 || h == 0) {
+		x = 0;
+		y = 0;
+		w = frame_width;
+		h = frame_height;
+	}
+	// output size registers count in units of 4 pixels
+	if (x < 0 || y < 0 || w <= 0 || h <= 0 || (w & 3) != 0 || (h & 3) != 0
+			|| x + w > frame_width || y + h > frame_height) {
+		return ESP_ERR_INVALID_ARG;
+	}
+	ESP_LOGD(TAG, "Sensor window: %dx%d at %d,%d", w, h, x, y);
+	geometry_t prev;
+	geometry_save(&prev);
+	if (s_state->sensor.set_window(&s_state->sensor, x, y, w, h) != 0) {
+		// the sensor may have taken part of the window
+		s_state->sensor_windowed = true;
+		geometry_restore(&prev, &s_state->config, false);
+		return ESP_ERR_CAMERA_FAILED_TO_SET_FRAME_SIZE;
+	}
+	s_state->sensor_width = w;
+	s_state->sensor_height = h;
+	s_state->sensor_windowed = (w != frame_width || h != frame_height);
+	s_state->window_x = x;
+	s_state->window_y = y;
+	// DMA and frame buffers follow the window, like a full frame region
+	// of interest
+	esp_err_t err = camera_set_roi(0, 0, 0, 0);
+	if (err != ESP_OK) {
+		// the sensor goes back to the previous window as well
+		geometry_restore(&prev, &s_state->config, true);
+		return err;
+	}
+	// skip the frame which was in flight while the window changed
+	vsync_wait(2);
+	esp_intr_disable(s_state->vsync_intr_handle);
+	return ESP_OK;
+}
+
+// Settings which camera_reconfigure can not change: pins and clock, the
+// frame buffer pool and the DMA ring.
+static bool reconfig_compatible(const camera_config_t* a,
+		const camera_config_t* b) {
+	// pins and xclk_freq_hz are the leading ints
+	if (memcmp(a, b, offsetof(camera_config_t, ledc_timer)) != 0) {
+		return false;
+	}
+	if (a->ledc_timer != b->ledc_timer || a->ledc_channel != b->ledc_channel
+			|| a->fb_count != b->fb_count || a->fb_disabled != b->fb_disabled
+			|| a->line_cb != b->line_cb || a->line_cb_arg != b->line_cb_arg
+			|| a->dma_lines != b->dma_lines
+			|| a->dma_buf_max != b->dma_buf_max
+			|| a->fb_static_buf != b->fb_static_buf
+			|| a->fb_static_size != b->fb_static_size) {
+		return false;
+	}
+	for (size_t i = 0; i < CAMERA_FB_ALLOC_CHAIN_MAX; ++i) {
+		if (a->fb_alloc[i] != b->fb_alloc[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+esp_err_t camera_reconfigure(const camera_config_t* config) {
+	if (s_state == NULL || s_state->dma_filter_task == NULL
+			|| s_state->streaming) {
+		return ESP_ERR_INVALID_STATE;
+	}
+	if (!reconfig_compatible(&s_state->config, config)) {
+		ESP_LOGE(TAG, "Only frame size, format, decimation, pyramid levels "
+				"and JPEG quality can be reconfigured");
+		return ESP_ERR_INVALID_ARG;
+	}
+	geometry_t prev;
+	geometry_save(&prev);
+	memcpy(&s_state->config, config, sizeof(*config));
+	esp_err_t err = frame_format_init(config);
+	if (err != ESP_OK) {
+		// nothing but state was changed yet
+		geometry_restore(&prev, NULL, false);
+		return err;
+	}
+	err = sensor_apply(config, &prev.config);
+	if (err != ESP_OK) {
+		geometry_restore(&prev, config, false);
+		return err;
+	}
+	I2S0.fifo_conf.rx_fifo_mod = s_state->sampling_mode;
+	// JPEG sizes seen with the old settings say nothing about the new ones
+	s_state->jpeg_hist_pos = 0;
+	s_state->jpeg_hist_count = 0;
+	// the auxiliary task only exists if camera_init started it
+	s_state->dual_filter = dual_filter_allowed()
+			&& s_state->dma_filter_aux_task != NULL;
+	err = arena_init();
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "Failed to allocate capture memory");
+		// the previous layout fitted before, unless memory is fragmented
+		geometry_restore(&prev, config, true);
+		return err;
+	}
+	// skip at least one frame after changing camera settings
+	vsync_wait(2);
+	esp_intr_disable(s_state->vsync_intr_handle);
+	return ESP_OK;
+}
+
+esp_err_t camera_set_jpeg_target(size_t frame_bytes) {
+	if (s_state == NULL) {
+		return ESP_ERR_INVALID_STATE;
+	}
+	if (s_state->config.pixel_format != CAMERA_PF_JPEG) {
+		return ESP_ERR_NOT_SUPPORTED;
+	}
+	s_state->config.jpeg_target_size = frame_bytes;
+	s_state->jpeg_target = frame_bytes;
+	return ESP_OK;
+}
+
+esp_err_t camera_set_jpeg_bitrate(uint32_t bits_per_second, int fps) {
+	if (fps <= 0) {
+		return ESP_ERR_INVALID_ARG;
+	}
+	return camera_set_jpeg_target(bits_per_second / 8 / fps);
+}
+
+esp_err_t camera_get_stats(camera_stats_t* out_stats) {
+	if (s_state == NULL) {
+		return ESP_ERR_INVALID_STATE;
+	}
+	out_stats->frames = s_state->frame_count;
+	out_stats->frames_dropped = s_state->frames_dropped;
+	out_stats->vsync_wait_us = s_state->vsync_wait_us;
+	out_stats->frames_truncated = s_state->frames_truncated;
+	out_stats->dma_overruns = s_state->dma_overruns;
+	out_stats->dma_lag_max = s_state->dma_lag_max;
+	out_stats->capture_memory = s_state->arena_size;
+	out_stats->jpeg_quality = (s_state->config.pixel_format == CAMERA_PF_JPEG) ?
+			s_state->jpeg_qs : -1;
+	return ESP_OK;
+}
+
+esp_err_t camera_get_fb_alloc_stats(camera_fb_alloc_policy_t policy,
+		camera_fb_alloc_stats_t* out_stats) {
+	if (s_state == NULL || s_state->fb_pool == NULL) {
+		return ESP_ERR_INVALID_STATE;
+	}
+	if (policy <= CAMERA_FB_ALLOC_NONE || policy > CAMERA_FB_ALLOC_STATIC) {
+		return ESP_ERR_INVALID_ARG;
+	}
+	const fb_policy_stats_t* st = &s_state->fb_allocator.stats[policy];
+	out_stats->bytes = st->bytes;
+	out_stats->allocs = st->allocs;
+	out_stats->failures = st->failures;
+	out_stats->largest_free = st->largest_free;
+	return ESP_OK;
+}
+
+esp_err_t camera_calibrate_dma(int frames, int max_lines, int* out_lines) {
+	if (s_state == NULL || s_state->streaming) {
+		return ESP_ERR_INVALID_STATE;
+	}
+	if (frames <= 0 || max_lines < 2) {
+		return ESP_ERR_INVALID_ARG;
+	}
+	ESP_LOGD(TAG, "Calibrating DMA ring with %d lines", max_lines);
+	// on any failure the previous ring depth and memory come back
+	geometry_t prev;
+	geometry_save(&prev);
+	esp_err_t err = dma_desc_resize(max_lines);
+	if (err != ESP_OK) {
+		geometry_restore(&prev, NULL, true);
+		return err;
+	}
+	s_state->dma_lag_max = 0;
+	size_t overruns = s_state->dma_overruns;
+	for (int i = 0; i < frames; ++i) {
+		err = camera_run();
+		if (err != ESP_OK && err != ESP_ERR_CAMERA_FRAME_TRUNCATED) {
+			geometry_restore(&prev, NULL, true);
+			return err;
+		}
+	}
+	if (s_state->dma_overruns != overruns) {
+		ESP_LOGE(TAG, "Filter can not keep up even with %d lines", max_lines);
+		geometry_restore(&prev, NULL, true);
+		return ESP_ERR_INVALID_SIZE;
+	}
+	// hold every buffer pending at the worst moment, plus the one being
+	// written by DMA, rounded up to whole lines, plus one line of margin
+	size_t dma_per_line = s_state->dma_per_line;
+	size_t lines = (s_state->dma_lag_max + dma_per_line) / dma_per_line + 1;
+	if (lines < 2) {
+		lines = 2;
+	}
+	ESP_LOGI(TAG, "Filter lag high-water mark: %d buffers, using %d lines",
+			s_state->dma_lag_max, lines);
+	err = dma_desc_resize(lines);
+	if (err != ESP_OK) {
+		geometry_restore(&prev, NULL, true);
+		return err;
+	}
+	s_state->dma_lag_max = 0;
+	if (out_lines) {
+		*out_lines = lines;
+	}
+	return ESP_OK;
+}
+
+// Heaps behind the frame buffer allocator policies
+static void* fb_heap_alloc(fb_policy_t heap, size_t size) {
+	if (heap == FB_POLICY_INTERNAL) {
+		return heap_caps_malloc(size, MALLOC_CAP_DMA);
+	}
+#if CONFIG_SPIRAM_SUPPORT
+	if (heap == FB_POLICY_SPIRAM) {
+		return heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+	}
+#endif
+	return NULL;
+}
+
+static void fb_heap_free(fb_policy_t heap, void* ptr) {
+	heap_caps_free(ptr);
+}
+
+static size_t fb_heap_largest_free(fb_policy_t heap) {
+	if (heap == FB_POLICY_INTERNAL) {
+		return heap_caps_get_largest_free_block(MALLOC_CAP_DMA);
+	}
+#if CONFIG_SPIRAM_SUPPORT
+	if (heap == FB_POLICY_SPIRAM) {
+		return heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM);
+	}
+#endif
+	return 0;
+}
+
+static const fb_heap_ops_t s_fb_heap_ops = {
+	.alloc = &fb_heap_alloc,
+	.free = &fb_heap_free,
+	.largest_free = &fb_heap_largest_free,
+};
+
+// Memory which is already allocated is kept for a new layout if it is
+// large enough, and not more than twice the size needed.
+static bool mem_reusable(size_t have, size_t need) {
+	return need <= have && have <= 2 * need;
+}
+
+// Bytes of one frame buffer allocation: the frame and its pyramid levels
+static size_t fb_block_size() {
+	size_t size = (s_state->fb_size + 3) & ~3;
+	for (size_t l = 1; l <= s_state->pyramid_levels; ++l) {
+		size += (s_state->width >> l) * (s_state->height >> l);
+	}
+	return size;
+}
+
+// Frame buffer descriptors, queues and the allocator. Buffers are
+// allocated by fb_pool_setup.
+static esp_err_t fb_pool_init() {
+	size_t count = s_state->fb_count;
+	const camera_config_t* config = &s_state->config;
+	fb_policy_t chain[FB_CHAIN_MAX];
+	for (size_t i = 0; i < FB_CHAIN_MAX; ++i) {
+		chain[i] = (fb_policy_t) config->fb_alloc[i];
+		if (chain[i] == FB_POLICY_STATIC && config->fb_static_buf == NULL) {
+			ESP_LOGE(TAG, "Static frame buffer policy without fb_static_buf");
+			return ESP_ERR_INVALID_ARG;
+		}
+	}
+	fb_alloc_init(&s_state->fb_allocator, &s_fb_heap_ops, chain,
+			config->fb_static_buf, config->fb_static_size);
+	s_state->fb_pool = (camera_fb_t*) calloc(count, sizeof(camera_fb_t));
+	s_state->fb_blocks = (fb_block_t*) calloc(count, sizeof(fb_block_t));
+	bool queued = fb_queue_create(&s_state->fb_queue, count);
+	if (s_state->fb_pool == NULL || s_state->fb_blocks == NULL || !queued) {
+		return ESP_ERR_NO_MEM;
+	}
+	return ESP_OK;
+}
+
+// Return every frame buffer to the pool after the arena was (re)built.
+// Buffers are kept if all of them still fit the frame, otherwise all are
+// freed first so a static buffer can be carved again from its start.
+static esp_err_t fb_pool_setup() {
+	size_t size = fb_block_size();
+	bool reuse = true;
+	for (size_t i = 0; i < s_state->fb_count; ++i) {
+		fb_block_t* block = &s_state->fb_blocks[i];
+		reuse = reuse && block->policy != FB_POLICY_NONE
+				&& mem_reusable(block->size, size);
+	}
+	fb_queue_reset(&s_state->fb_queue);
+	for (size_t i = 0; i < s_state->fb_count && !reuse; ++i) {
+		fb_free(&s_state->fb_allocator, &s_state->fb_blocks[i]);
+	}
+	for (size_t i = 0; i < s_state->fb_count; ++i) {
+		camera_fb_t* fb = &s_state->fb_pool[i];
+		fb_block_t* block = &s_state->fb_blocks[i];
+		if (reuse) {
+			memset(block->ptr, 0, block->size);
+		} else if (!fb_alloc(&s_state->fb_allocator, size, block)) {
+			ESP_LOGE(TAG, "No frame buffer policy can hold %d bytes", size);
+			return ESP_ERR_NO_MEM;
+		}
+		ESP_LOGD(TAG, "Frame buffer #%d: %d bytes, policy %d", i,
+				block->size, block->policy);
+		fb->buf = (uint8_t*) block->ptr;
+		// pyramid levels follow the frame, smallest last
+		memset(fb->pyramid, 0, sizeof(fb->pyramid));
+		uint8_t* level = fb->buf + ((s_state->fb_size + 3) & ~3);
+		for (size_t l = 1; l <= s_state->pyramid_levels; ++l) {
+			fb->pyramid[l - 1] = level;
+			level += (s_state->width >> l) * (s_state->height >> l);
+		}
+		fb->len = 0;
+		fb->size = s_state->fb_size;
+		fb->width = s_state->width;
+		fb->height = s_state->height;
+		fb->format = s_state->config.pixel_format;
+		fb->truncated = false;
+		if (i > 0) {
+			fb_queue_release(&s_state->fb_queue, fb);
+		}
+	}
+	s_state->fb_cur = &s_state->fb_pool[0];
+	s_state->fb = s_state->fb_cur->buf;
+	return ESP_OK;
+}
+
+static void fb_pool_deinit() {
+	free(s_state->fb_pool);
+	free(s_state->fb_blocks);
+	fb_queue_delete(&s_state->fb_queue);
+	s_state->fb_pool = NULL;
+	s_state->fb_blocks = NULL;
+}
+
+// Called by the filter task once the current pool buffer is filled.
+// Hands it to the consumer and switches capture to the next free buffer.
+static void stream_frame_done() {
+	camera_fb_t* done = s_state->fb_cur;
+	done->seq = s_state->frame_count++;
+
+	camera_fb_t* next = (camera_fb_t*) fb_queue_frame_done(&s_state->fb_queue,
+			done, &s_state->frames_dropped);
+	if (next == done) {
+		return;
+	}
+	fb_fit(next);
+	s_state->fb_cur = next;
+	s_state->fb = next->buf;
+}
+
+// Resize a JPEG frame buffer towards the current target size. Only called
+// for a buffer which is about to be filled, before any line is written.
+static void fb_fit(camera_fb_t* fb) {
+#if CONFIG_CAMERA_JPEG_ADAPTIVE_FB
+	size_t target = s_state->fb_size;
+	if (s_state->config.pixel_format != CAMERA_PF_JPEG || fb->size == target) {
+		return;
+	}
+	// grow right away, shrink only once well above the target
+	if (fb->size > target && fb->size < target + target / 4) {
+		return;
+	}
+	// contents are about to be overwritten, no need to copy them
+	fb_block_t* block = &s_state->fb_blocks[fb - s_state->fb_pool];
+	if (!fb_realloc(&s_state->fb_allocator, block, target)) {
+		if (block->ptr == NULL) {
+			// lost while shrinking, frames are truncated until a resize works
+			fb->buf = NULL;
+			fb->size = 0;
+		}
+		// warn once per size, this is retried with every frame
+		if (s_state->fb_fit_failed != target) {
+			ESP_LOGW(TAG, "Failed to resize frame buffer to %d bytes", target);
+			s_state->fb_fit_failed = target;
+		}
+		return;
+	}
+	ESP_LOGD(TAG, "Frame buffer resized from %d to %d bytes", fb->size, target);
+	fb->buf = (uint8_t*) block->ptr;
+	fb->size = target;
+#endif
+}
+
+// Learn the JPEG frame buffer size from recent frames: the configured
+// percentile of the last JPEG_SIZE_HISTORY frame sizes plus headroom.
+static void jpeg_fb_size_update(size_t frame_size, bool truncated) {
+#if CONFIG_CAMERA_JPEG_ADAPTIVE_FB
+	size_t target;
+	if (truncated) {
+		// real size is unknown, double the buffer which was too small
+		target = s_state->fb_cur->size * 2;
+	} else {
+		s_state->jpeg_hist[s_state->jpeg_hist_pos] = frame_size;
+		s_state->jpeg_hist_pos = (s_state->jpeg_hist_pos + 1)
+				% JPEG_SIZE_HISTORY;
+		if (s_state->jpeg_hist_count < JPEG_SIZE_HISTORY) {
+			s_state->jpeg_hist_count++;
+		}
+		size_t n = s_state->jpeg_hist_count;
+		size_t sorted[JPEG_SIZE_HISTORY];
+		for (size_t i = 0; i < n; ++i) {
+			size_t v = s_state->jpeg_hist[i];
+			size_t j = i;
+			for (; j > 0 && sorted[j - 1] > v; --j) {
+				sorted[j] = sorted[j - 1];
+			}
+			sorted[j] = v;
+		}
+		size_t pct = sorted[(n - 1) * CONFIG_CAMERA_JPEG_FB_PERCENTILE / 100];
+		target = pct + pct * CONFIG_CAMERA_JPEG_FB_HEADROOM / 100;
+	}
+	target = (target + JPEG_FB_ALIGN - 1) & ~(JPEG_FB_ALIGN - 1);
+	if (target < JPEG_FB_MIN_SIZE) {
+		target = JPEG_FB_MIN_SIZE;
+	}
+	size_t max_size = s_state->width * s_state->height * 2;
+	if (target > max_size) {
+		target = max_size;
+	}
+	s_state->fb_size = target;
+#endif
+}
+
+// Steer QS toward jpeg_target from the size of the frame just completed.
+// JPEG size falls roughly in proportion to QS, so a frame over the target
+// scales QS up by the excess at once. A frame below the hysteresis band
+// lowers QS by one step only, which keeps QS from oscillating around the
+// target. The ov2640 applies a new QS a frame late, so the frame after a
+// change is not taken into account.
+static void jpeg_rate_update(size_t frame_size, bool truncated) {
+	size_t target = s_state->jpeg_target;
+	if (target == 0) {
+		return;
+	}
+	if (s_state->jpeg_rate_hold > 0) {
+		s_state->jpeg_rate_hold--;
+		return;
+	}
+	int qs = s_state->jpeg_qs;
+	if (truncated) {
+		// the real size is unknown, at least the frame buffer size
+		qs += JPEG_QS_STEP_MAX;
+	} else if (frame_size > target) {
+		int base = (qs > 0) ? qs : 1;
+		int step = (base * (frame_size - target) + target - 1) / target;
+		qs += (step < JPEG_QS_STEP_MAX) ? step : JPEG_QS_STEP_MAX;
+	} else if (frame_size
+			< target - target * CONFIG_CAMERA_JPEG_RATE_BAND / 100) {
+		qs--;
+	}
+	qs = (qs < 0) ? 0 : (qs > JPEG_QS_MAX) ? JPEG_QS_MAX : qs;
+	if (qs == s_state->jpeg_qs) {
+		return;
+	}
+	ESP_LOGD(TAG, "JPEG %d bytes, target %d: QS %d -> %d", frame_size,
+			target, s_state->jpeg_qs, qs);
+	s_state->jpeg_qs = qs;
+	if (s_state->jpeg_soft) {
+		// takes effect with the next frame
+		jpeg_enc_set_quality(&s_state->jpeg_enc, soft_jpeg_quality(qs));
+	} else {
+		// bank select and QS, two SCCB writes
+		(*s_state->sensor.set_quality)(&s_state->sensor, qs);
+		s_state->jpeg_rate_hold = 1;
+	}
+}
+
+// Number of lines signaled by one DMA interrupt. Small frames have short
+// lines and reach the highest frame rates, so one interrupt per line costs
+// the most there. Lines are grouped as long as the group fits the byte
+// budget and frames are a whole number of groups, so that a frame always
+// ends on an interrupt. JPEG needs per-buffer progress for EOI and VSYNC.
+static size_t dma_lines_per_eof(size_t line_size) {
+	if (!CONFIG_CAMERA_DMA_COALESCE
+			|| s_state->config.pixel_format == CAMERA_PF_JPEG) {
+		return 1;
+	}
+	size_t lines = CONFIG_CAMERA_DMA_COALESCE_BYTES / line_size;
+	for (; lines > 1; --lines) {
+		if (s_state->sensor_height % lines == 0) {
+			break;
+		}
+	}
+	return (lines > 0) ? lines : 1;
+}
+
+// Work out the DMA ring for the current line length: lines are split into
+// dma_per_line buffers of at most dma_buf_max bytes, the ring holds
+// dma_lines lines.
+static esp_err_t dma_geometry() {
+	assert(s_state->sensor_width % 4 == 0);
+	size_t line_size = s_state->sensor_width * s_state->in_bytes_per_pixel
 			* i2s_bytes_per_sample(s_state->sampling_mode);
 	ESP_LOGD(TAG, "Line width (for DMA): %d bytes", line_size);
 	size_t dma_per_line = 1;
 	size_t buf_size = line_size;
-	while (buf_size >= 4096) {
+	while (buf_size > s_state->dma_buf_max) {
 		buf_size /= 2;
 		dma_per_line *= 2;
 	}
-	size_t dma_desc_count = dma_per_line * 4;
+	if ((s_state->sensor_width / dma_per_line) % s_state->decimation != 0) {
+		ESP_LOGE(TAG, "DMA buffer width does not allow decimation by %d",
+				s_state->decimation);
+		return ESP_ERR_INVALID_ARG;
+	}
+	// the ring holds at least two interrupts worth of lines, so that DMA
+	// fills one group while the other one is being filtered
+	size_t lines_per_eof = dma_lines_per_eof(line_size);
+	size_t ring_lines = s_state->dma_lines;
+	if (ring_lines < lines_per_eof * 2) {
+		ring_lines = lines_per_eof * 2;
+	}
+	ring_lines = (ring_lines + lines_per_eof - 1) / lines_per_eof
+			* lines_per_eof;
+	size_t dma_desc_count = dma_per_line * ring_lines;
 	s_state->dma_buf_width = line_size;
 	s_state->dma_per_line = dma_per_line;
+	// without grouping, every buffer has its own interrupt
+	s_state->dma_per_eof = (lines_per_eof > 1) ?
+			dma_per_line * lines_per_eof : 1;
+	s_state->dma_buf_size = buf_size;
 	s_state->dma_desc_count = dma_desc_count;
+	// room for every descriptor in the ring plus frame markers
+	size_t ring_size = 1;
+	while (ring_size < dma_desc_count * 2) {
+		ring_size *= 2;
+	}
+	s_state->dma_ring_mask = ring_size - 1;
 	ESP_LOGD(TAG, "DMA buffer size: %d, DMA buffers per line: %d", buf_size,
 			dma_per_line);
-	ESP_LOGD(TAG, "DMA buffer count: %d", dma_desc_count);
+	ESP_LOGD(TAG, "DMA buffer count: %d (%d lines, %d lines per interrupt)",
+			dma_desc_count, ring_lines, lines_per_eof);
+	return ESP_OK;
+}
 
-	s_state->dma_buf = (dma_elem_t**) malloc(
-			sizeof(dma_elem_t*) * dma_desc_count);
-	if (s_state->dma_buf == NULL) {
-		return ESP_ERR_NO_MEM;
-	}
-	s_state->dma_desc = (lldesc_t*) malloc(sizeof(lldesc_t) * dma_desc_count);
-	if (s_state->dma_desc == NULL) {
-		return ESP_ERR_NO_MEM;
-	}
+// Link the descriptors to their buffers, once the arena is laid out.
+static void dma_desc_setup() {
 	size_t dma_sample_count = 0;
-	for (int i = 0; i < dma_desc_count; ++i) {
-		ESP_LOGD(TAG, "Allocating DMA buffer #%d, size=%d", i, buf_size);
-		dma_elem_t* buf = (dma_elem_t*) malloc(buf_size);
-		if (buf == NULL) {
-			return ESP_ERR_NO_MEM;
-		}
-		s_state->dma_buf[i] = buf;
-		ESP_LOGV(TAG, "dma_buf[%d]=%p", i, buf);
-
+	for (int i = 0; i < s_state->dma_desc_count; ++i) {
 		lldesc_t* pd = &s_state->dma_desc[i];
-		pd->length = buf_size;
+		pd->length = s_state->dma_buf_size;
 		if (s_state->sampling_mode == SM_0A0B_0B0C
-				&& (i + 1) % dma_per_line == 0) {
+				&& (i + 1) % s_state->dma_per_line == 0) {
 			pd->length -= 4;
 		}
 		dma_sample_count += pd->length / 4;
 		pd->size = pd->length;
 		pd->owner = 1;
 		pd->sosf = 1;
-		pd->buf = (uint8_t*) buf;
+		pd->buf = (uint8_t*) s_state->dma_buf[i];
 		pd->offset = 0;
 		pd->empty = 0;
 		pd->eof = 1;
-		pd->qe.stqe_next = &s_state->dma_desc[(i + 1) % dma_desc_count];
+		pd->qe.stqe_next = &s_state->dma_desc[(i + 1) % s_state->dma_desc_count];
+		ESP_LOGV(TAG, "dma_buf[%d]=%p", i, s_state->dma_buf[i]);
 	}
-	s_state->dma_done = false;
+	s_state->dma_ring_wr = 0;
+	s_state->dma_ring_rd = 0;
+	s_state->aux_ring_wr = 0;
+	s_state->aux_ring_rd = 0;
+	s_state->dma_done = true;
 	s_state->dma_sample_count = dma_sample_count;
+	// every group of lines has the same number of samples
+	s_state->dma_eof_samples = (s_state->dma_per_eof > 1) ?
+			dma_sample_count
+					/ (s_state->dma_desc_count / s_state->dma_per_eof) :
+			dma_sample_count;
+	dma_span_init();
+}
+
+// Reserve size bytes at *pos of the arena, keeping words aligned. While
+// the arena is only being sized (base is NULL) no memory is handed out.
+static void* arena_carve(uint8_t* base, size_t* pos, size_t size) {
+	void* p = (base != NULL) ? base + *pos : NULL;
+	*pos += (size + 3) & ~3;
+	return p;
+}
+
+// Lay out all capture memory from base and return its size. Called once
+// with NULL to size the arena, then again to place everything in it.
+static size_t arena_layout(uint8_t* base) {
+	size_t pos = 0;
+	size_t count = s_state->dma_desc_count;
+	size_t ring_size = s_state->dma_ring_mask + 1;
+	size_t line_size = s_state->width * s_state->fb_bytes_per_pixel;
+	s_state->dma_desc = (lldesc_t*) arena_carve(base, &pos,
+			sizeof(lldesc_t) * count);
+	s_state->dma_buf = (dma_elem_t**) arena_carve(base, &pos,
+			sizeof(dma_elem_t*) * count);
+	s_state->dma_span = (dma_span_t*) arena_carve(base, &pos,
+			sizeof(dma_span_t) * s_state->dma_per_line);
+	s_state->dma_ring = (size_t*) arena_carve(base, &pos,
+			sizeof(size_t) * ring_size);
+	s_state->aux_ring = NULL;
+	if (s_state->dual_filter) {
+		s_state->aux_ring = (dma_work_t*) arena_carve(base, &pos,
+				sizeof(dma_work_t) * ring_size);
+	}
+	for (size_t i = 0; i < count; ++i) {
+		void* buf = arena_carve(base, &pos, s_state->dma_buf_size);
+		if (base != NULL) {
+			s_state->dma_buf[i] = (dma_elem_t*) buf;
+		}
+	}
+	s_state->decim_line = NULL;
+	s_state->decim_acc = NULL;
+	if (s_state->decim_box) {
+		// lines of a box are summed up before the average is stored
+		s_state->decim_line = (uint8_t*) arena_carve(base, &pos, line_size);
+		s_state->decim_acc = (uint16_t*) arena_carve(base, &pos,
+				line_size * sizeof(uint16_t));
+	}
+	// software JPEG holds one strip of lines until it is encoded
+	s_state->jpeg_strip = NULL;
+	if (s_state->jpeg_soft) {
+		s_state->jpeg_strip = (uint8_t*) arena_carve(base, &pos,
+				jpeg_enc_strip_lines(&s_state->jpeg_enc) * line_size);
+	}
+	// without frame buffers, frames only ever exist one line at a time
+	s_state->line_buf = NULL;
+	if (s_state->config.fb_disabled) {
+		s_state->line_buf = (uint8_t*) arena_carve(base, &pos, line_size);
+	}
+	return pos;
+}
+
+// (Re)build all capture memory for the current configuration: DMA
+// descriptors, DMA buffers and rings come from a single DMA capable block,
+// sized before anything is allocated, frame buffers from the frame buffer
+// allocator. Only called while DMA is idle.
+static esp_err_t arena_init() {
+	esp_err_t err = dma_geometry();
+	if (err != ESP_OK) {
+		arena_deinit();
+		return err;
+	}
+	size_t size = arena_layout(NULL);
+	ESP_LOGI(TAG, "Capture memory: %d bytes (%d DMA buffers of %d bytes), "
+			"plus %d frame buffers of %d bytes", size,
+			s_state->dma_desc_count, s_state->dma_buf_size,
+			s_state->fb_count, fb_block_size());
+	if (s_state->arena != NULL && mem_reusable(s_state->arena_size, size)) {
+		memset(s_state->arena, 0, size);
+	} else {
+		heap_caps_free(s_state->arena);
+		s_state->arena = (uint8_t*) heap_caps_calloc(size, 1, MALLOC_CAP_DMA);
+		if (s_state->arena == NULL) {
+			ESP_LOGE(TAG, "Failed to allocate %d bytes of DMA capable memory "
+					"(largest free block: %d)", size,
+					heap_caps_get_largest_free_block(MALLOC_CAP_DMA));
+			arena_deinit();
+			return ESP_ERR_NO_MEM;
+		}
+		s_state->arena_size = size;
+	}
+	arena_layout(s_state->arena);
+	dma_desc_setup();
+	if (s_state->fb_pool != NULL) {
+		return fb_pool_setup();
+	}
 	return ESP_OK;
 }
 
-static void dma_desc_deinit() {
-	if (s_state->dma_buf) {
-		for (int i = 0; i < s_state->dma_desc_count; ++i) {
-			free(s_state->dma_buf[i]);
+// Cut the DMA buffers of a line to the region of interest. Without one,
+// every span covers its whole DMA buffer.
+static void dma_span_init() {
+	size_t dma_per_line = s_state->dma_per_line;
+	size_t pixels = s_state->sensor_width / dma_per_line;
+	size_t dma_bytes_per_pixel = s_state->in_bytes_per_pixel
+			* i2s_bytes_per_sample(s_state->sampling_mode);
+	size_t roi_start = s_state->roi_x;
+	size_t roi_end = roi_start + s_state->width * s_state->decimation;
+	s_state->span_first = dma_per_line;
+	s_state->span_count = 0;
+	for (size_t i = 0; i < dma_per_line; ++i) {
+		dma_span_t* span = &s_state->dma_span[i];
+		size_t start = i * pixels;
+		size_t end = start + pixels;
+		start = (start > roi_start) ? start : roi_start;
+		end = (end < roi_end) ? end : roi_end;
+		if (start >= end) {
+			memset(span, 0, sizeof(*span));
+			continue;
+		}
+		size_t offset = (start - i * pixels) * dma_bytes_per_pixel;
+		size_t len = (end - start) * dma_bytes_per_pixel;
+		// the last buffer of a line is one word short in SM_0A0B_0B0C
+		if (len > s_state->dma_desc[i].length - offset) {
+			len = s_state->dma_desc[i].length - offset;
+		}
+		span->src_offset = offset / sizeof(dma_elem_t);
+		span->len = len;
+		span->fb_offset = (start - roi_start) / s_state->decimation
+				* s_state->fb_bytes_per_pixel;
+		span->fb_len = (end - start) / s_state->decimation
+				* s_state->fb_bytes_per_pixel;
+		if (s_state->span_count++ == 0) {
+			s_state->span_first = i;
+		}
+	}
+}
+
+// Release all capture memory: the arena in one go, and the frame buffers.
+static void arena_deinit() {
+	if (s_state->fb_pool != NULL) {
+		for (size_t i = 0; i < s_state->fb_count; ++i) {
+			camera_fb_t* fb = &s_state->fb_pool[i];
+			fb_free(&s_state->fb_allocator, &s_state->fb_blocks[i]);
+			fb->buf = NULL;
+			memset(fb->pyramid, 0, sizeof(fb->pyramid));
 		}
 	}
-	free(s_state->dma_buf);
-	free(s_state->dma_desc);
+	heap_caps_free(s_state->arena);
+	s_state->arena = NULL;
+	s_state->arena_size = 0;
+	s_state->dma_desc = NULL;
+	s_state->dma_buf = NULL;
+	s_state->dma_span = NULL;
+	s_state->dma_ring = NULL;
+	s_state->aux_ring = NULL;
+	s_state->decim_line = NULL;
+	s_state->decim_acc = NULL;
+	s_state->line_buf = NULL;
+	s_state->jpeg_strip = NULL;
+	s_state->fb_cur = NULL;
+	s_state->fb = NULL;
+}
+
+// Rebuild the descriptor ring with a different depth while DMA is idle.
+static esp_err_t dma_desc_resize(size_t lines) {
+	s_state->dma_lines = lines;
+	return arena_init();
 }
 
 static inline void i2s_conf_reset() {
@@ -590,14 +1757,13 @@ static void i2s_init() {
 			&i2s_isr, NULL, &s_state->i2s_intr_handle);
 }
 
-static void i2s_stop() {
+static void i2s_stop(bool* need_yield) {
+	s_state->dma_done = true;
 	esp_intr_disable(s_state->i2s_intr_handle);
 	esp_intr_disable(s_state->vsync_intr_handle);
 	i2s_conf_reset();
 	I2S0.conf.rx_start = 0;
-	size_t val = SIZE_MAX;
-	BaseType_t higher_priority_task_woken;
-	xQueueSendFromISR(s_state->data_ready, &val, &higher_priority_task_woken);
+	dma_ring_push(DMA_FRAME_END, need_yield);
 }
 
 static void i2s_run() {
@@ -612,64 +1778,177 @@ static void i2s_run() {
 #endif
 
 	// wait for vsync
-	ESP_LOGD(TAG, "Waiting for positive edge on VSYNC");
-	while (gpio_get_level(s_state->config.pin_vsync) == 0) {
-		;
-	}
-	while (gpio_get_level(s_state->config.pin_vsync) != 0) {
-		;
-	}
+	ESP_LOGD(TAG, "Waiting for negative edge on VSYNC");
+	vsync_wait(1);
 	ESP_LOGD(TAG, "Got VSYNC");
 
 	s_state->dma_done = false;
 	s_state->dma_desc_cur = 0;
 	s_state->dma_received_count = 0;
-	s_state->dma_filtered_count = 0;
+	s_state->dma_received_total = 0;
+	s_state->dma_released_total = 0;
+	s_state->aux_released_total = 0;
+	s_state->dma_ring_rd = s_state->dma_ring_wr;
+	frame_reset();
 	esp_intr_disable(s_state->i2s_intr_handle);
 	i2s_conf_reset();
 
-	I2S0.rx_eof_num = s_state->dma_sample_count;
+	I2S0.rx_eof_num = s_state->dma_eof_samples;
 	I2S0.in_link.addr = (uint32_t) &s_state->dma_desc[0];
 	I2S0.in_link.start = 1;
 	I2S0.int_clr.val = I2S0.int_raw.val;
 	I2S0.int_ena.val = 0;
-	I2S0.int_ena.in_done = 1;
+	if (s_state->dma_per_eof > 1) {
+		// one interrupt each time rx_eof_num samples have been received
+		I2S0.int_ena.in_suc_eof = 1;
+	} else {
+		I2S0.int_ena.in_done = 1;
+	}
 	esp_intr_enable(s_state->i2s_intr_handle);
-	if (s_state->config.pixel_format == CAMERA_PF_JPEG) {
-		esp_intr_enable(s_state->vsync_intr_handle);
+	if ((s_state->config.pixel_format != CAMERA_PF_JPEG || s_state->jpeg_soft)
+			&& !s_state->free_running) {
+		esp_intr_disable(s_state->vsync_intr_handle);
 	}
 	I2S0.conf.rx_start = 1;
 
 }
 
-static void IRAM_ATTR signal_dma_buf_received(bool* need_yield) {
-	size_t dma_desc_filled = s_state->dma_desc_cur;
-	s_state->dma_desc_cur = (dma_desc_filled + 1) % s_state->dma_desc_count;
-	s_state->dma_received_count++;
-	BaseType_t higher_priority_task_woken;
-	BaseType_t ret = xQueueSendFromISR(s_state->data_ready, &dma_desc_filled,
+// Block the calling task until the given number of VSYNC falling edges
+// have been seen. Leaves VSYNC interrupt enabled.
+static void vsync_wait(int edges) {
+	int64_t start = esp_timer_get_time();
+	// discard an edge which was signaled before we started waiting
+	xSemaphoreTake(s_state->vsync_sem, 0);
+	esp_intr_enable(s_state->vsync_intr_handle);
+	for (int i = 0; i < edges; ++i) {
+		xSemaphoreTake(s_state->vsync_sem, portMAX_DELAY);
+	}
+	s_state->vsync_wait_us += esp_timer_get_time() - start;
+}
+
+// Stop DMA from task context and discard anything queued after the
+// current frame.
+static void i2s_halt() {
+	s_state->dma_done = true;
+	esp_intr_disable(s_state->i2s_intr_handle);
+	esp_intr_disable(s_state->vsync_intr_handle);
+	I2S0.conf.rx_start = 0;
+	i2s_conf_reset();
+	s_state->free_running = false;
+	s_state->dma_ring_rd = s_state->dma_ring_wr;
+}
+
+// Restart DMA at the current descriptor without waiting for VSYNC.
+// Used at frame boundaries in free-running mode, so that a partially
+// filled descriptor never carries data from two frames.
+static void IRAM_ATTR i2s_relink() {
+	I2S0.conf.rx_start = 0;
+	i2s_conf_reset();
+	I2S0.rx_eof_num = s_state->dma_eof_samples;
+	I2S0.in_link.addr = (uint32_t) &s_state->dma_desc[s_state->dma_desc_cur];
+	I2S0.in_link.start = 1;
+	I2S0.conf.rx_start = 1;
+}
+
+// Single producer side of dma_ring. Both producers (I2S and VSYNC
+// interrupts) run at the same level on the same core, so they never
+// preempt each other. The filter task is woken with a task notification
+// and drains everything available, so back-to-back pushes cost one wakeup.
+static void IRAM_ATTR dma_ring_push(size_t item, bool* need_yield) {
+	size_t wr = s_state->dma_ring_wr;
+	size_t room = s_state->dma_ring_mask + 1;
+	if (item != DMA_FRAME_END && item != DMA_FRAME_DROP) {
+		room -= DMA_RING_RESERVE;
+	}
+	if (wr - s_state->dma_ring_rd >= room) {
+		s_state->dma_overruns++;
+		return;
+	}
+	s_state->dma_ring[wr & s_state->dma_ring_mask] = item;
+	// publish the item before the index
+	__sync_synchronize();
+	s_state->dma_ring_wr = wr + 1;
+	BaseType_t higher_priority_task_woken = pdFALSE;
+	vTaskNotifyGiveFromISR(s_state->dma_filter_task,
 			&higher_priority_task_woken);
-	if (ret != pdTRUE) {
-		ESP_EARLY_LOGW(TAG, "queue send failed (%d), dma_received_count=%d",
-				ret, s_state->dma_received_count);
+	*need_yield |= (higher_priority_task_woken == pdTRUE);
+}
+
+// Signal count buffers starting at dma_desc_cur, pushed as one item.
+static void IRAM_ATTR signal_dma_buf_received(size_t count, bool* need_yield) {
+	size_t dma_desc_filled = s_state->dma_desc_cur;
+	s_state->dma_desc_cur = (dma_desc_filled + count) % s_state->dma_desc_count;
+	s_state->dma_received_count += count;
+	s_state->dma_received_total += count;
+	// buffers received but not yet filtered; once all of them are pending,
+	// DMA is overwriting data the filter has not read yet
+	size_t lag = s_state->dma_received_total - s_state->dma_released_total
+			- s_state->aux_released_total;
+	if (lag > s_state->dma_lag_max) {
+		s_state->dma_lag_max = lag;
+	}
+	if (lag >= s_state->dma_desc_count) {
+		s_state->dma_overruns++;
 	}
-	*need_yield = (ret == pdTRUE && higher_priority_task_woken == pdTRUE);
+	dma_ring_push(DMA_ITEM(dma_desc_filled, count), need_yield);
+}
+
+// Buffers of the current group which DMA has written to when VSYNC ends
+// the frame before the group is complete: up to and including the
+// descriptor DMA is working on.
+static size_t IRAM_ATTR dma_group_received() {
+	if (s_state->dma_per_eof == 1) {
+		return 1;
+	}
+	const lldesc_t* cur = (const lldesc_t*) (uintptr_t) I2S0.inlink_dscr;
+	size_t idx = cur - s_state->dma_desc;
+	size_t count = (idx + s_state->dma_desc_count - s_state->dma_desc_cur)
+			% s_state->dma_desc_count + 1;
+	return (count < s_state->dma_per_eof) ? count : s_state->dma_per_eof;
 }
 
 static void IRAM_ATTR i2s_isr(void* arg) {
 	I2S0.int_clr.val = I2S0.int_raw.val;
-	bool need_yield;
-	signal_dma_buf_received(&need_yield);
+	if (s_state->dma_done) {
+		// stopped from the filter task while this interrupt was pending
+		return;
+	}
+	bool need_yield = false;
+	signal_dma_buf_received(s_state->dma_per_eof, &need_yield);
 	ESP_EARLY_LOGV(TAG, "isr, cnt=%d", s_state->dma_received_count);
 	if (s_state->dma_received_count
-			== s_state->height * s_state->dma_per_line) {
-		i2s_stop();
+			== s_state->sensor_height * s_state->dma_per_line) {
+		if (!s_state->free_running) {
+			i2s_stop(&need_yield);
+		} else if (s_state->config.pixel_format != CAMERA_PF_JPEG
+				|| s_state->jpeg_soft) {
+			// frame complete, DMA carries on with the next one
+			s_state->dma_received_count = 0;
+			dma_ring_push(DMA_FRAME_END, &need_yield);
+		}
 	}
 	if (need_yield) {
 		portYIELD_FROM_ISR();
 	}
 }
 
+// VSYNC while DMA is free-running. JPEG frames end here. Fixed size frames
+// were already closed by the line count, so a non-zero count means lines
+// were lost: the partial frame is dropped and DMA re-synchronized.
+static void IRAM_ATTR vsync_free_running(bool* need_yield) {
+	if (s_state->dma_done || s_state->dma_received_count == 0) {
+		return;
+	}
+	if (s_state->config.pixel_format == CAMERA_PF_JPEG && !s_state->jpeg_soft) {
+		signal_dma_buf_received(dma_group_received(), need_yield);
+		dma_ring_push(DMA_FRAME_END, need_yield);
+	} else {
+		dma_ring_push(DMA_FRAME_DROP, need_yield);
+	}
+	s_state->dma_received_count = 0;
+	i2s_relink();
+}
+
 static void IRAM_ATTR gpio_isr(void* arg) {
 	uint32_t isr = GPIO.status;
 	if (isr == 0)
@@ -678,10 +1957,17 @@ static void IRAM_ATTR gpio_isr(void* arg) {
 	GPIO.status_w1tc = GPIO.status;
 	bool need_yield = false;
 	ESP_EARLY_LOGV(TAG, "gpio isr, cnt=%d", s_state->dma_received_count);
-	if (gpio_get_level(s_state->config.pin_vsync) == 0
-			&& s_state->dma_received_count > 0 && !s_state->dma_done) {
-		signal_dma_buf_received(&need_yield);
-		i2s_stop();
+	if (gpio_get_level(s_state->config.pin_vsync) == 0) {
+		BaseType_t higher_priority_task_woken = pdFALSE;
+		xSemaphoreGiveFromISR(s_state->vsync_sem, &higher_priority_task_woken);
+		need_yield = (higher_priority_task_woken == pdTRUE);
+		if (s_state->free_running) {
+			vsync_free_running(&need_yield);
+		} else if (s_state->dma_received_count > 0 && !s_state->dma_done) {
+			// only the part of the group DMA has reached holds frame data
+			signal_dma_buf_received(dma_group_received(), &need_yield);
+			i2s_stop(&need_yield);
+		}
 	}
 	if (need_yield) {
 		portYIELD_FROM_ISR();
@@ -689,114 +1975,400 @@ static void IRAM_ATTR gpio_isr(void* arg) {
 }
 
 static size_t get_fb_pos() {
-	return s_state->dma_filtered_count * s_state->width
-			* s_state->fb_bytes_per_pixel / s_state->dma_per_line;
+	size_t line = s_state->dma_filtered_count / s_state->span_count;
+	size_t part = s_state->dma_filtered_count % s_state->span_count;
+	return line * s_state->width * s_state->fb_bytes_per_pixel
+			+ s_state->dma_span[s_state->span_first + part].fb_offset;
 }
 
-static void IRAM_ATTR dma_filter_task(void *pvParameters) {
+// Reset per-frame filter state before the first line of a frame.
+static void frame_reset() {
+	s_state->dma_filtered_count = 0;
+	s_state->dma_in_count = 0;
+	s_state->frame_closed = false;
+	s_state->frame_truncated = false;
+	s_state->jpeg_soi = false;
+	s_state->jpeg_eoi = false;
+	s_state->jpeg_prev = 0;
+}
+
+// Hand over a completed frame: pass it to the consumer and keep capturing
+// while streaming, otherwise stop DMA and wake up camera_run.
+static void frame_end() {
+	camera_fb_t* fb = s_state->fb_cur;
+	if (fb != NULL) {
+		fb->len = s_state->data_size;
+		fb->truncated = s_state->frame_truncated;
+	}
+	if (s_state->frame_truncated) {
+		s_state->frames_truncated++;
+	}
+	if (s_state->config.pixel_format == CAMERA_PF_JPEG) {
+		jpeg_fb_size_update(fb->len, fb->truncated);
+		jpeg_rate_update(fb->len, fb->truncated);
+	}
+	frame_reset();
+	if (s_state->streaming) {
+		if (fb != NULL) {
+			stream_frame_done();
+		} else {
+			// lines went to line_cb, nothing to hand over
+			s_state->frame_count++;
+		}
+		if (s_state->streaming) {
+			if (!s_state->free_running) {
+				i2s_run();
+			}
+			return;
+		}
+	}
+	if (s_state->free_running) {
+		i2s_halt();
+	}
+	xSemaphoreGive(s_state->frame_ready);
+}
+
+// Look for SOI/EOI markers in JPEG data just written at fb offset `pos`.
+// Returns true once EOI is found, with data_size set to the exact image length.
+static bool jpeg_scan_markers(const uint8_t* data, size_t len, size_t pos) {
+	if (len == 0) {
+		return false;
+	}
+	const uint8_t* end = data + len;
+	// code points to the byte following 0xff
+	const uint8_t* code = data;
+	if (s_state->jpeg_prev != 0xff) {
+		code = memchr(data, 0xff, len);
+		code = (code != NULL) ? code + 1 : NULL;
+	}
+	while (code != NULL && code < end) {
+		if (*code == 0xd8) {
+			s_state->jpeg_soi = true;
+		} else if (*code == 0xd9 && s_state->jpeg_soi) {
+			s_state->jpeg_eoi = true;
+			s_state->data_size = pos + (code - data) + 1;
+			return true;
+		}
+		code = memchr(code, 0xff, end - code);
+		code = (code != NULL) ? code + 1 : NULL;
+	}
+	s_state->jpeg_prev = end[-1];
+	return false;
+}
+
+// EOI was seen, the rest of the frame carries only padding.
+static void jpeg_frame_close() {
+#if CONFIG_CAMERA_JPEG_STOP_ON_EOI
+	if (!s_state->free_running) {
+		// nothing more is needed from this frame, stop DMA right away
+		i2s_halt();
+	}
+	frame_end();
+	// free-running DMA carries on into the next frame, skip the rest of this one
+	s_state->frame_closed = s_state->free_running;
+#else
+	// filter nothing more, but let VSYNC end the frame
+	s_state->frame_closed = true;
+#endif
+}
+
+// Pass a DMA buffer (or DMA_FRAME_END to flush) to dma_filter_aux_task.
+// Returns false if the auxiliary task is too far behind to take it. One
+// DMA_FRAME_END is pushed per frame and waited for, so with the reserved
+// slot it always fits.
+static bool IRAM_ATTR aux_push(size_t buf_idx, uint8_t* dst) {
+	size_t wr = s_state->aux_ring_wr;
+	size_t room = s_state->dma_ring_mask + 1;
+	if (buf_idx != DMA_FRAME_END) {
+		room -= AUX_RING_RESERVE;
+	}
+	if (wr - s_state->aux_ring_rd >= room) {
+		return false;
+	}
+	dma_work_t* w = &s_state->aux_ring[wr & s_state->dma_ring_mask];
+	w->buf_idx = buf_idx;
+	w->dst = dst;
+	__sync_synchronize();
+	s_state->aux_ring_wr = wr + 1;
+	xTaskNotifyGive(s_state->dma_filter_aux_task);
+	return true;
+}
+
+// Filters the lines handed over by dma_filter_task on the other core.
+// Lines are disjoint, so both tasks write the frame buffer without locking.
+static void IRAM_ATTR dma_filter_aux_task(void *pvParameters) {
 	while (true) {
-		size_t buf_idx;
-		xQueueReceive(s_state->data_ready, &buf_idx, portMAX_DELAY);
-		if (buf_idx == SIZE_MAX) {
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		while (s_state->aux_ring_rd != s_state->aux_ring_wr) {
+			size_t rd = s_state->aux_ring_rd;
+			dma_work_t w = s_state->aux_ring[rd & s_state->dma_ring_mask];
+			s_state->aux_ring_rd = rd + 1;
+			if (w.buf_idx == DMA_FRAME_END) {
+				xSemaphoreGive(s_state->aux_done);
+				continue;
+			}
+			dma_filter_run(w.buf_idx, w.dst);
+			s_state->aux_released_total++;
+		}
+	}
+}
+
+static bool dma_filter_buf(size_t buf_idx);
+
+// Add a line of a box to the sums, when decimating by averaging.
+// Only the last line of a box is written to the frame buffer.
+static void IRAM_ATTR dma_decim_accumulate(size_t buf_idx, bool first) {
+	const dma_span_t* span = &s_state->dma_span[buf_idx % s_state->dma_per_line];
+	size_t n = span->fb_len;
+	uint8_t* line = s_state->decim_line + span->fb_offset;
+	uint16_t* acc = s_state->decim_acc + span->fb_offset;
+	(*s_state->dma_filter)(s_state->dma_buf[buf_idx] + span->src_offset,
+			span->len, line);
+	if (first) {
+		for (size_t i = 0; i < n; ++i) {
+			acc[i] = line[i];
+		}
+	} else {
+		for (size_t i = 0; i < n; ++i) {
+			acc[i] += line[i];
+		}
+	}
+}
+
+// Filter one DMA buffer to dst, finishing the box average if decimating
+// by averaging.
+static void IRAM_ATTR dma_filter_run(size_t buf_idx, uint8_t* dst) {
+	const dma_span_t* span = &s_state->dma_span[buf_idx % s_state->dma_per_line];
+	const dma_elem_t* buf = s_state->dma_buf[buf_idx] + span->src_offset;
+	size_t len = span->len;
+	if (!s_state->decim_box) {
+		(*s_state->dma_filter)(buf, len, dst);
+		return;
+	}
+	size_t n = span->fb_len;
+	uint8_t* line = s_state->decim_line + span->fb_offset;
+	const uint16_t* acc = s_state->decim_acc + span->fb_offset;
+	size_t d = s_state->decimation;
+	(*s_state->dma_filter)(buf, len, line);
+	for (size_t i = 0; i < n; ++i) {
+		dst[i] = (acc[i] + line[i] + d / 2) / d;
+	}
+}
+
+// Downscale the frame buffer line just completed into the pyramid levels.
+// Each odd line closes a row of 2x2 blocks of the level above, which in
+// turn may close a row of the next level, so every level is written while
+// its source lines are still in cache.
+static void IRAM_ATTR pyramid_update(size_t line) {
+	camera_fb_t* fb = s_state->fb_cur;
+	size_t width = s_state->width;
+	const uint8_t* src = s_state->fb + line * width;
+	for (size_t l = 0; l < s_state->pyramid_levels && (line & 1); ++l) {
+		const uint8_t* above = src - width;
+		width /= 2;
+		line /= 2;
+		uint8_t* dst = fb->pyramid[l] + line * width;
+		for (size_t x = 0; x < width; ++x) {
+			dst[x] = (above[2 * x] + above[2 * x + 1] + src[2 * x]
+					+ src[2 * x + 1] + 2) >> 2;
+		}
+		src = dst;
+	}
+}
+
+// Filter one DMA buffer into the line buffer, passing each completed line
+// to line_cb. Used when there is no frame buffer.
+static bool IRAM_ATTR dma_filter_line_buf(size_t buf_idx) {
+	dma_filter_run(buf_idx, s_state->line_buf
+			+ s_state->dma_span[buf_idx % s_state->dma_per_line].fb_offset);
+	s_state->dma_filtered_count++;
+	if (s_state->dma_filtered_count % s_state->span_count == 0) {
+		size_t line = s_state->dma_filtered_count / s_state->span_count - 1;
+		(*s_state->config.line_cb)(s_state->line_buf,
+				s_state->width * s_state->fb_bytes_per_pixel, line,
+				s_state->config.line_cb_arg);
+	}
+	return true;
+}
+
+// Filter one DMA buffer into the JPEG strip buffer and encode every
+// completed strip into the frame buffer. Used for software JPEG.
+static bool IRAM_ATTR dma_filter_strip(size_t buf_idx) {
+	jpeg_encoder_t* enc = &s_state->jpeg_enc;
+	size_t strip_lines = jpeg_enc_strip_lines(enc);
+	size_t line_size = s_state->width * s_state->fb_bytes_per_pixel;
+	size_t line = s_state->dma_filtered_count / s_state->span_count;
+	if (s_state->dma_filtered_count == 0) {
+		jpeg_enc_begin(enc, s_state->fb, s_state->fb_cur->size);
+	}
+	dma_filter_run(buf_idx, s_state->jpeg_strip
+			+ (line % strip_lines) * line_size
+			+ s_state->dma_span[buf_idx % s_state->dma_per_line].fb_offset);
+	s_state->dma_filtered_count++;
+	// once the output is full, the rest of the frame is not worth encoding
+	if (s_state->dma_filtered_count % (strip_lines * s_state->span_count)
+			== 0 && !enc->overflow) {
+		jpeg_enc_strip(enc, s_state->jpeg_strip, line_size, strip_lines);
+	}
+	return true;
+}
+
+// Encode the lines left in the strip buffer and close the JPEG image.
+static void jpeg_strip_frame_end() {
+	jpeg_encoder_t* enc = &s_state->jpeg_enc;
+	size_t lines = s_state->dma_filtered_count / s_state->span_count;
+	if (lines == 0) {
+		s_state->data_size = 0;
+		return;
+	}
+	size_t rest = lines % jpeg_enc_strip_lines(enc);
+	if (rest > 0 && !enc->overflow) {
+		jpeg_enc_strip(enc, s_state->jpeg_strip,
+				s_state->width * s_state->fb_bytes_per_pixel, rest);
+	}
+	s_state->data_size = jpeg_enc_finish(enc);
+	// a short frame leaves MCU rows out of the image
+	if (enc->overflow || lines < s_state->height) {
+		s_state->frame_truncated = true;
+	}
+}
+
+// Handle one item from dma_ring: a run of filled DMA buffers, or a frame
+// marker.
+static void IRAM_ATTR dma_filter_item(size_t item) {
+	if (item == DMA_FRAME_DROP) {
+		frame_reset();
+		s_state->frames_dropped++;
+		return;
+	}
+	if (item == DMA_FRAME_END) {
+		// with STOP_ON_EOI a closed frame has been handed over already
+		bool delivered = s_state->frame_closed
+				&& CONFIG_CAMERA_JPEG_STOP_ON_EOI;
+		if (delivered) {
+			frame_reset();
+			return;
+		}
+		if (s_state->jpeg_strip != NULL) {
+			jpeg_strip_frame_end();
+		} else if (s_state->dma_filter_planar != NULL) {
+			// chroma planes follow the luma plane
+			s_state->data_size = s_state->fb_size;
+		} else if (!s_state->jpeg_eoi) {
 			s_state->data_size = get_fb_pos();
-			xSemaphoreGive(s_state->frame_ready);
-			continue;
 		}
+		// frame is complete only once the other core is done with its lines,
+		// aux_done is only given for a marker which was queued
+		if (s_state->dual_filter && aux_push(DMA_FRAME_END, NULL)) {
+			xSemaphoreTake(s_state->aux_done, portMAX_DELAY);
+		}
+		frame_end();
+		return;
+	}
+	size_t buf_idx = item & ((1 << DMA_ITEM_SHIFT) - 1);
+	size_t count = item >> DMA_ITEM_SHIFT;
+	for (size_t i = 0; i < count; ++i) {
+		if (dma_filter_buf(buf_idx + i)) {
+			s_state->dma_released_total++;
+		}
+		if (s_state->frame_closed || s_state->dma_in_count == 0) {
+			// the frame was closed or reset by this buffer (JPEG EOI with
+			// STOP_ON_EOI), the rest of the group must not be filtered
+			// into the next frame
+			s_state->dma_released_total += count - i - 1;
+			break;
+		}
+	}
+}
 
-		uint8_t* pfb = s_state->fb + get_fb_pos();
-		const dma_elem_t* buf = s_state->dma_buf[buf_idx];
-		lldesc_t* desc = &s_state->dma_desc[buf_idx];
-		ESP_LOGV(TAG, "dma_flt: pos=%d ", get_fb_pos());
-		(*s_state->dma_filter)(buf, desc, pfb);
+// Filter one DMA buffer into the frame buffer. Returns false if the
+// buffer was handed to the auxiliary filter task instead.
+static bool IRAM_ATTR dma_filter_buf(size_t buf_idx) {
+	if (s_state->frame_closed || s_state->frame_truncated) {
+		return true;
+	}
+	size_t in_line = s_state->dma_in_count++ / s_state->dma_per_line;
+	// lines and columns outside the region of interest are never filtered
+	const dma_span_t* span = &s_state->dma_span[buf_idx % s_state->dma_per_line];
+	if (in_line < s_state->roi_y || span->len == 0
+			|| in_line >= s_state->roi_y
+					+ s_state->height * s_state->decimation) {
+		return true;
+	}
+	if (s_state->decimation > 1) {
+		size_t phase = in_line % s_state->decimation;
+		if (!s_state->decim_box && phase != 0) {
+			// line is not needed, drop it before it touches the frame buffer
+			return true;
+		}
+		if (s_state->decim_box && phase != s_state->decimation - 1) {
+			dma_decim_accumulate(buf_idx, phase == 0);
+			return true;
+		}
+	}
+
+	if (s_state->jpeg_strip != NULL) {
+		return dma_filter_strip(buf_idx);
+	}
+	if (s_state->line_buf != NULL) {
+		return dma_filter_line_buf(buf_idx);
+	}
+	size_t pos = get_fb_pos();
+	if (pos + span->fb_len > s_state->fb_cur->size) {
+		// frame does not fit, keep what was written and skip the rest
+		ESP_LOGV(TAG, "dma_flt: frame truncated at %d", pos);
+		s_state->frame_truncated = true;
+		return true;
+	}
+	uint8_t* pfb = s_state->fb + pos;
+	size_t line = s_state->dma_filtered_count / s_state->span_count;
+	if (s_state->dual_filter && (line & 1) && aux_push(buf_idx, pfb)) {
+		// odd lines are filtered on the other core
 		s_state->dma_filtered_count++;
-		ESP_LOGV(TAG, "dma_flt: flt_count=%d ", s_state->dma_filtered_count);
-	}
-}
-
-static void IRAM_ATTR dma_filter_grayscale(const dma_elem_t* src,
-		lldesc_t* dma_desc, uint8_t* dst) {
-	assert(s_state->sampling_mode == SM_0A0B_0C0D);
-	size_t end = dma_desc->length / sizeof(dma_elem_t) / 4;
-	for (size_t i = 0; i < end; ++i) {
-		// manually unrolling 4 iterations of the loop here
-		dst[0] = src[0].sample1;
-		dst[1] = src[1].sample1;
-		dst[2] = src[2].sample1;
-		dst[3] = src[3].sample1;
-		src += 4;
-		dst += 4;
-	}
-}
-
-static void IRAM_ATTR dma_filter_grayscale_highspeed(const dma_elem_t* src,
-		lldesc_t* dma_desc, uint8_t* dst) {
-	assert(s_state->sampling_mode == SM_0A0B_0B0C);
-	size_t end = dma_desc->length / sizeof(dma_elem_t) / 8;
-	for (size_t i = 0; i < end; ++i) {
-		// manually unrolling 4 iterations of the loop here
-		dst[0] = src[0].sample1;
-		dst[1] = src[2].sample1;
-		dst[2] = src[4].sample1;
-		dst[3] = src[6].sample1;
-		src += 8;
-		dst += 4;
-	}
-	// the final sample of a line in SM_0A0B_0B0C sampling mode needs special handling
-	if ((dma_desc->length & 0x7) != 0) {
-		dst[0] = src[0].sample1;
-		dst[1] = src[2].sample1;
-	}
-}
-
-static void IRAM_ATTR dma_filter_jpeg(const dma_elem_t* src, lldesc_t* dma_desc,
-		uint8_t* dst) {
-	assert(
-			s_state->sampling_mode == SM_0A0B_0B0C
-					|| s_state->sampling_mode == SM_0A00_0B00);
-	size_t end = dma_desc->length / sizeof(dma_elem_t) / 4;
-	// manually unrolling 4 iterations of the loop here
-	for (size_t i = 0; i < end; ++i) {
-		dst[0] = src[0].sample1;
-		dst[1] = src[1].sample1;
-		dst[2] = src[2].sample1;
-		dst[3] = src[3].sample1;
-		src += 4;
-		dst += 4;
-	}
-	// the final sample of a line in SM_0A0B_0B0C sampling mode needs special handling
-	if ((dma_desc->length & 0x7) != 0) {
-		dst[0] = src[0].sample1;
-		dst[1] = src[1].sample1;
-		dst[2] = src[2].sample1;
-		dst[3] = src[2].sample2;
-	}
-}
-
-static inline void rgb565_to_888(uint8_t in1, uint8_t in2, uint8_t* dst) {
-	dst[0] = (in2 & 0b00011111) << 3; // blue
-	dst[1] = ((in1 & 0b111) << 5) | ((in2 & 0b11100000 >> 5)); // green
-	dst[2] = in1 & 0b11111000; // red
-}
-
-static void IRAM_ATTR dma_filter_rgb565(const dma_elem_t* src,
-		lldesc_t* dma_desc, uint8_t* dst) {
-	assert(
-			s_state->sampling_mode == SM_0A0B_0B0C
-					|| s_state->sampling_mode == SM_0A00_0B00);
-
-	const int unroll = 2;         // manually unrolling 2 iterations of the loop
-	const int samples_per_pixel = 2;
-	const int bytes_per_pixel = 3;
-	size_t end = dma_desc->length / sizeof(dma_elem_t) / unroll
-			/ samples_per_pixel;
-	for (size_t i = 0; i < end; ++i) {
-		rgb565_to_888(src[0].sample1, src[1].sample1, &dst[0]);
-		rgb565_to_888(src[2].sample1, src[3].sample1, &dst[3]);
-		dst += bytes_per_pixel * unroll;
-		src += samples_per_pixel * unroll;
-	}
-	if ((dma_desc->length & 0x7) != 0) {
-		rgb565_to_888(src[0].sample1, src[1].sample1, &dst[0]);
-		rgb565_to_888(src[2].sample1, src[2].sample2, &dst[3]);
+		return false;
+	}
+	ESP_LOGV(TAG, "dma_flt: pos=%d ", pos);
+	if (s_state->dma_filter_planar != NULL && (line & 1) == 0) {
+		// I420 chroma planes, at half the resolution of the luma plane
+		size_t part = s_state->dma_filtered_count % s_state->dma_per_line;
+		size_t chroma_width = s_state->width / 2;
+		size_t chroma_size = chroma_width * s_state->height / 2;
+		uint8_t* pu = s_state->fb + s_state->width * s_state->height
+				+ (line / 2) * chroma_width
+				+ part * (chroma_width / s_state->dma_per_line);
+		(*s_state->dma_filter_planar)(s_state->dma_buf[buf_idx],
+				s_state->dma_desc[buf_idx].length, pfb, pu, pu + chroma_size);
+	} else {
+		dma_filter_run(buf_idx, pfb);
+	}
+	s_state->dma_filtered_count++;
+	ESP_LOGV(TAG, "dma_flt: flt_count=%d ", s_state->dma_filtered_count);
+	bool line_done = (s_state->dma_filtered_count % s_state->span_count == 0);
+	if (s_state->pyramid_levels > 0 && line_done) {
+		pyramid_update(line);
+	}
+	if (s_state->config.line_cb != NULL && line_done) {
+		size_t line_size = s_state->width * s_state->fb_bytes_per_pixel;
+		(*s_state->config.line_cb)(s_state->fb + line * line_size, line_size,
+				line, s_state->config.line_cb_arg);
+	}
+	if (s_state->config.pixel_format == CAMERA_PF_JPEG
+			&& jpeg_scan_markers(pfb, get_fb_pos() - pos, pos)) {
+		jpeg_frame_close();
+	}
+	return true;
+}
+
+static void IRAM_ATTR dma_filter_task(void *pvParameters) {
+	while (true) {
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		// drain everything signaled since the last wakeup
+		while (s_state->dma_ring_rd != s_state->dma_ring_wr) {
+			size_t rd = s_state->dma_ring_rd;
+			size_t item = s_state->dma_ring[rd & s_state->dma_ring_mask];
+			// release the slot first, i2s_halt may discard the rest of the ring
+			s_state->dma_ring_rd = rd + 1;
+			dma_filter_item(item);
+		}
 	}
 }
@@ -11,47 +11,81 @@
 #include "freertos/task.h"
 #include "camera.h"
 #include "sensor.h"
+#include "dma_filter.h"
+#include "fb_alloc.h"
+#include "fb_queue.h"
+#include "jpeg_encoder.h"
 
-typedef union {
-    struct {
-        uint8_t sample2;
-        uint8_t unused2;
-        uint8_t sample1;
-        uint8_t unused1;
-    };
-    uint32_t val;
-} dma_elem_t;
+#define JPEG_SIZE_HISTORY 16    // frames used to size JPEG frame buffers
 
-typedef enum {
-    /* camera sends byte sequence: s1, s2, s3, s4, ...
-     * fifo receives: 00 s1 00 s2, 00 s2 00 s3, 00 s3 00 s4, ...
-     */
-    SM_0A0B_0B0C = 0,
-    /* camera sends byte sequence: s1, s2, s3, s4, ...
-     * fifo receives: 00 s1 00 s2, 00 s3 00 s4, ...
-     */
-    SM_0A0B_0C0D = 1,
-    /* camera sends byte sequence: s1, s2, s3, s4, ...
-     * fifo receives: 00 s1 00 00, 00 s2 00 00, 00 s3 00 00, ...
-     */
-    SM_0A00_0B00 = 3,
-} i2s_sampling_mode_t;
+typedef struct {
+    size_t buf_idx;                     // DMA buffer to filter, or a frame marker
+    uint8_t *dst;                       // frame buffer position of the data
+} dma_work_t;
 
-typedef void (*dma_filter_t)(const dma_elem_t* src, lldesc_t* dma_desc, uint8_t* dst);
+// Part of a DMA buffer which lands in the frame buffer. All lines are cut
+// the same way, so there is one span for each DMA buffer of a line.
+typedef struct {
+    uint16_t src_offset;                // first DMA word of the span
+    uint16_t len;                       // DMA bytes to filter, 0 if outside the region of interest
+    uint16_t fb_offset;                 // position of the span in a frame buffer line
+    uint16_t fb_len;                    // frame buffer bytes written
+} dma_span_t;
 
 typedef struct {
     camera_config_t config;
     sensor_t sensor;
     uint8_t *fb;
     size_t fb_size;
+    uint8_t *line_buf;                  // single line, used instead of fb when fb_disabled
     size_t data_size;
-    size_t width;
+    size_t width;                       // frame buffer size, after decimation
     size_t height;
+    size_t sensor_width;                // frame size sent by the sensor
+    size_t sensor_height;
+    bool sensor_windowed;               // camera_set_window narrowed the sensor output
+    size_t window_x;                    // position of the sensor window, if any
+    size_t window_y;
+    size_t roi_x;                       // region of interest, in sensor pixels; width and height are its size
+    size_t roi_y;
+    size_t decimation;                  // 1, 2 or 4, both directions
+    bool decim_box;                     // average decimated pixels instead of skipping
+    uint8_t *decim_line;                // one filtered line, box decimation only
+    uint16_t *decim_acc;                // sums of the lines of a box so far
+    size_t pyramid_levels;              // downscaled levels filled along with the frame buffer
     size_t in_bytes_per_pixel;
     size_t fb_bytes_per_pixel;
     size_t stride;
     size_t frame_count;
+    size_t frames_dropped;
+    size_t frames_truncated;
+
+    camera_fb_t *fb_pool;
+    fb_block_t *fb_blocks;              // memory of each pool buffer
+    fb_allocator_t fb_allocator;
+    size_t fb_fit_failed;               // last size fb_fit could not place, to warn once
+    size_t fb_count;
+    camera_fb_t *fb_cur;
+    fb_queue_t fb_queue;                // pool buffers between capture and consumer
+    bool streaming;
+    bool free_running;
+    bool frame_closed;
+    bool frame_truncated;
+    bool jpeg_soi;
+    bool jpeg_eoi;
+    uint8_t jpeg_prev;
+    size_t jpeg_hist[JPEG_SIZE_HISTORY];
+    size_t jpeg_hist_pos;
+    size_t jpeg_hist_count;
+    bool jpeg_soft;                     // JPEG encoded by jpeg_enc, the sensor sends YUYV
+    jpeg_encoder_t jpeg_enc;
+    uint8_t *jpeg_strip;                // lines waiting to be encoded, one MCU row
+    int jpeg_qs;                        // current QS, jpeg_quality unless rate control moved it
+    size_t jpeg_target;                 // rate control target, bytes per frame, 0 if off
+    size_t jpeg_rate_hold;              // frames to ignore until a new QS shows
 
+    uint8_t *arena;                     // all capture memory, see arena_init
+    size_t arena_size;                  // bytes allocated, may exceed the current layout
     lldesc_t *dma_desc;
     dma_elem_t **dma_buf;
     bool dma_done;
@@ -59,16 +93,46 @@ typedef struct {
     size_t dma_desc_cur;
     size_t dma_received_count;
     size_t dma_filtered_count;
+    size_t dma_in_count;                // DMA buffers of this frame seen by the filter task
     size_t dma_per_line;
+    dma_span_t *dma_span;               // dma_per_line spans, for parts of a line
+    size_t span_first;                  // first part of a line inside the region of interest
+    size_t span_count;                  // parts of a line inside the region of interest
     size_t dma_buf_width;
+    size_t dma_buf_size;                // bytes of each DMA buffer
     size_t dma_sample_count;
+    size_t dma_per_eof;                 // DMA buffers signaled by one interrupt
+    size_t dma_eof_samples;             // rx_eof_num, samples per interrupt
     i2s_sampling_mode_t sampling_mode;
     dma_filter_t dma_filter;
+    dma_filter_planar_t dma_filter_planar;  // even lines of I420 frames, dma_filter does luma of odd lines
     intr_handle_t i2s_intr_handle;
     intr_handle_t vsync_intr_handle;
-    QueueHandle_t data_ready;
+    size_t *dma_ring;                   // filled DMA buffer indexes and frame markers
+    size_t dma_ring_mask;               // ring size - 1, ring size is a power of two
+    // dma_ring_wr is advanced by interrupts and dma_ring_rd by dma_filter_task.
+    // dma_desc_setup, i2s_run and i2s_halt also reset them, but only while the
+    // I2S interrupt is disabled and dma_filter_task is not filtering: from
+    // that task at a frame end, or from camera_run while it is idle.
+    volatile size_t dma_ring_wr;
+    volatile size_t dma_ring_rd;
+    size_t dma_overruns;
+    size_t dma_lines;                   // depth of the descriptor ring, in lines
+    size_t dma_buf_max;                 // largest DMA buffer, lines are split to fit
+    volatile size_t dma_received_total;   // buffers received since DMA was started
+    volatile size_t dma_released_total;   // ... filtered by dma_filter_task
+    volatile size_t aux_released_total;   // ... filtered by dma_filter_aux_task
+    size_t dma_lag_max;                 // high-water mark of received - filtered
+    bool dual_filter;                   // odd lines are filtered by dma_filter_aux_task
+    dma_work_t *aux_ring;               // dma_filter_task -> dma_filter_aux_task, same size as dma_ring
+    volatile size_t aux_ring_wr;        // advanced by dma_filter_task, reset by dma_desc_setup
+    volatile size_t aux_ring_rd;        // advanced by dma_filter_aux_task, reset by dma_desc_setup
+    SemaphoreHandle_t aux_done;
     SemaphoreHandle_t frame_ready;
+    SemaphoreHandle_t vsync_sem;
+    uint64_t vsync_wait_us;
     TaskHandle_t dma_filter_task;
+    TaskHandle_t dma_filter_aux_task;
 } camera_state_t;
 
 extern camera_state_t* s_state ;
@@ -0,0 +1,462 @@
+// Copyright 2015-2016 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <stdint.h>
+#include <stdbool.h>
+#include "dma_filter.h"
+#ifdef ESP_PLATFORM
+#include "sdkconfig.h"
+#include "esp_attr.h"
+#else
+// host build: every filter, nothing to place in IRAM
+#define IRAM_ATTR
+#define CONFIG_CAMERA_FILTER_GRAYSCALE 1
+#define CONFIG_CAMERA_FILTER_RGB565 1
+#define CONFIG_CAMERA_FILTER_YUV422 1
+#define CONFIG_CAMERA_FILTER_JPEG 1
+#define CONFIG_CAMERA_FILTER_DECIMATION 1
+#define CONFIG_CAMERA_DMA_PACKED 1
+#endif
+
+// All filters are instances of two templates, filter() and filter_planar(),
+// which are always inlined with constant arguments: sampling mode, output
+// layout, unroll factor, horizontal decimation and destination alignment.
+// Every instance is a straight loop over DMA words with no run time
+// dispatch. Only the instances of formats enabled in menuconfig are
+// compiled, everything else stays out of IRAM.
+//
+// Filters read whole DMA words and pack output bytes into a register
+// before storing them with aligned 32-bit stores. The byte order of packed
+// words assumes a little-endian CPU, as on the ESP32. Each instance exists
+// twice: for word aligned destinations, and with byte stores for the rest.
+//
+// Packing only pays off for multi-byte pixels. For one byte per pixel
+// without decimation (Y8, RAW) bench_dma_filter measured it slower than a
+// byte load and a byte store per pixel, so those instances use
+// filter_bytes() instead.
+#define FILTER_INLINE static inline __attribute__((always_inline))
+
+#ifndef CONFIG_CAMERA_FILTER_UNROLL
+#define CONFIG_CAMERA_FILTER_UNROLL 2
+#endif
+
+#define FILTER_Y8      (CONFIG_CAMERA_FILTER_GRAYSCALE || CONFIG_CAMERA_FILTER_YUV422)
+#define FILTER_RAW     (CONFIG_CAMERA_FILTER_JPEG || CONFIG_CAMERA_FILTER_YUV422)
+
+FILTER_INLINE void put32(uint8_t* dst, uint32_t v, bool aligned) {
+	if (aligned) {
+		*(uint32_t*) dst = v;
+	} else {
+		dst[0] = v;
+		dst[1] = v >> 8;
+		dst[2] = v >> 16;
+		dst[3] = v >> 24;
+	}
+}
+
+FILTER_INLINE bool is_aligned(const uint8_t* dst) {
+	return ((uintptr_t) dst & 3) == 0;
+}
+
+FILTER_INLINE size_t samples_per_word(i2s_sampling_mode_t mode) {
+	return (mode == SM_0A0B_0C0D) ? 2 : 1;
+}
+
+// Camera bytes carried by a DMA buffer of len bytes. In SM_0A0B_0B0C the
+// last buffer of a line is one word short, its final byte is sample2 of
+// the last word.
+FILTER_INLINE size_t sample_count(size_t len, i2s_sampling_mode_t mode) {
+	size_t words = len / sizeof(uint32_t);
+	if (mode == SM_0A0B_0C0D) {
+		return words * 2;
+	}
+	if (mode == SM_0A0B_0B0C && (len & 0x7) != 0) {
+		return words + 1;
+	}
+	return words;
+}
+
+// Camera byte i of a DMA buffer. i is a constant within an unrolled group,
+// so this folds into a single shift and mask.
+FILTER_INLINE uint32_t sample_at(const uint32_t* src, size_t i,
+		i2s_sampling_mode_t mode) {
+	if (mode == SM_0A0B_0C0D) {
+		return (i & 1) ? (src[i / 2] & 0xff) : ((src[i / 2] >> 16) & 0xff);
+	}
+	return (src[i] >> 16) & 0xff;
+}
+
+// Same as sample_at, also valid for the final byte of a short SM_0A0B_0B0C
+// buffer. Only used for the last few pixels of a buffer.
+FILTER_INLINE uint32_t sample_at_end(const uint32_t* src, size_t i,
+		size_t words, i2s_sampling_mode_t mode) {
+	if (mode == SM_0A0B_0B0C && i >= words) {
+		return src[words - 1] & 0xff;
+	}
+	return sample_at(src, i, mode);
+}
+
+// Camera bytes consumed by one output pixel (or byte, for raw data)
+FILTER_INLINE size_t unit_samples(dma_filter_layout_t layout) {
+	return (layout == DMA_FILTER_RAW) ? 1 : 2;
+}
+
+// Frame buffer bytes written for one output pixel
+FILTER_INLINE size_t unit_bytes(dma_filter_layout_t layout) {
+	switch (layout) {
+	case DMA_FILTER_Y8:
+	case DMA_FILTER_RAW:
+		return 1;
+	case DMA_FILTER_RGB565_BE:
+	case DMA_FILTER_RGB565_LE:
+		return 2;
+	default:
+		return 3;
+	}
+}
+
+// RGB565 pixel from its two bytes (high byte first), as BGR888 or RGB888
+// packed into the low 24 bits
+FILTER_INLINE uint32_t rgb565_to_888(uint32_t in1, uint32_t in2, bool bgr) {
+	uint32_t b = (in2 & 0b00011111) << 3;
+	uint32_t g = ((in1 & 0b111) << 5) | ((in2 & 0b11100000) >> 3);
+	uint32_t r = in1 & 0b11111000;
+	if (bgr) {
+		return b | (g << 8) | (r << 16);
+	}
+	return r | (g << 8) | (b << 16);
+}
+
+// Output pixel from its camera bytes, packed into the low unit_bytes bytes
+FILTER_INLINE uint32_t unit_value(uint32_t in1, uint32_t in2,
+		dma_filter_layout_t layout) {
+	switch (layout) {
+	case DMA_FILTER_Y8:     // YUYV, Y is the first byte of a pixel
+	case DMA_FILTER_RAW:
+		return in1;
+	case DMA_FILTER_RGB565_BE:
+		return in1 | (in2 << 8);
+	case DMA_FILTER_RGB565_LE:
+		return in2 | (in1 << 8);
+	case DMA_FILTER_BGR888:
+		return rgb565_to_888(in1, in2, true);
+	default:
+		return rgb565_to_888(in1, in2, false);
+	}
+}
+
+// Camera byte i, from sample_at_end at the end of a buffer
+#define SAMPLE(i)  (at_end ? sample_at_end(src, (i), words, mode) \
+		: sample_at(src, (i), mode))
+
+// Output pixel whose camera bytes start at i. With hdecim > 1 the
+// following pixels are skipped, or averaged in when box is set (Y8 only).
+FILTER_INLINE uint32_t unit_at(const uint32_t* src, size_t i, size_t words,
+		i2s_sampling_mode_t mode, dma_filter_layout_t layout, size_t hdecim,
+		bool box, bool at_end) {
+	if (box) {
+		uint32_t sum = 0;
+		for (size_t k = 0; k < hdecim; ++k) {
+			sum += SAMPLE(i + 2 * k);
+		}
+		return (sum + hdecim / 2) / hdecim;
+	}
+	return unit_value(SAMPLE(i), SAMPLE(i + 1), layout);
+}
+
+// Output pixel u of the group starting at src
+#define UNIT(u)  unit_at(src, (u) * step, words, mode, layout, hdecim, box, \
+		false)
+
+FILTER_INLINE void filter(const uint32_t* src, size_t len, uint8_t* dst,
+		i2s_sampling_mode_t mode, dma_filter_layout_t layout, size_t unroll,
+		size_t hdecim, bool box, bool aligned) {
+	const size_t step = unit_samples(layout) * hdecim;
+	const size_t bytes = unit_bytes(layout);
+	// pixels per group, a group fills a whole number of words
+	const size_t group = (bytes == 2) ? 2 : 4;
+	const size_t words = len / sizeof(uint32_t);
+	const size_t units = sample_count(len, mode) / step;
+	// groups never touch the final byte of a short SM_0A0B_0B0C buffer
+	const size_t fast_units = words * samples_per_word(mode) / step;
+	const size_t groups = fast_units / (group * unroll) * unroll;
+	const uint32_t* src_start = src;
+
+	for (size_t i = 0; i < groups; i += unroll) {
+		for (size_t r = 0; r < unroll; ++r) {
+			if (bytes == 1) {
+				put32(dst, UNIT(0) | (UNIT(1) << 8) | (UNIT(2) << 16)
+						| (UNIT(3) << 24), aligned);
+			} else if (bytes == 2) {
+				put32(dst, UNIT(0) | (UNIT(1) << 16), aligned);
+			} else {
+				uint32_t p0 = UNIT(0);
+				uint32_t p1 = UNIT(1);
+				uint32_t p2 = UNIT(2);
+				uint32_t p3 = UNIT(3);
+				put32(dst, p0 | (p1 << 24), aligned);
+				put32(dst + 4, (p1 >> 8) | (p2 << 16), aligned);
+				put32(dst + 8, (p2 >> 16) | (p3 << 8), aligned);
+			}
+			src += group * step / samples_per_word(mode);
+			dst += group * bytes;
+		}
+	}
+	// remaining pixels, one at a time
+	src = src_start;
+	for (size_t u = groups * group; u < units; ++u) {
+		uint32_t v = unit_at(src, u * step, words, mode, layout, hdecim, box,
+				true);
+		for (size_t b = 0; b < bytes; ++b) {
+			*dst++ = v >> (8 * b);
+		}
+	}
+}
+
+// Camera byte i of a DMA buffer, as a byte load
+FILTER_INLINE uint8_t sample_byte(const dma_elem_t* src, size_t i,
+		i2s_sampling_mode_t mode) {
+	if (mode == SM_0A0B_0C0D) {
+		return (i & 1) ? src[i / 2].sample2 : src[i / 2].sample1;
+	}
+	return src[i].sample1;
+}
+
+// Y8 or RAW without decimation: one byte per pixel, stored as is, four
+// pixels per iteration. Unrolling further only made it slower.
+FILTER_INLINE void filter_bytes(const dma_elem_t* src, size_t len,
+		uint8_t* dst, i2s_sampling_mode_t mode, dma_filter_layout_t layout) {
+	const size_t step = unit_samples(layout);
+	const size_t words = len / sizeof(uint32_t);
+	const size_t units = sample_count(len, mode) / step;
+	const size_t fast_units = words * samples_per_word(mode) / step;
+	const size_t groups = fast_units / 4;
+	const dma_elem_t* src_start = src;
+
+	for (size_t i = 0; i < groups; ++i) {
+		dst[0] = sample_byte(src, 0, mode);
+		dst[1] = sample_byte(src, step, mode);
+		dst[2] = sample_byte(src, 2 * step, mode);
+		dst[3] = sample_byte(src, 3 * step, mode);
+		src += 4 * step / samples_per_word(mode);
+		dst += 4;
+	}
+	// remaining pixels, including the final byte of a short SM_0A0B_0B0C
+	// buffer
+	for (size_t u = groups * 4; u < units; ++u) {
+		*dst++ = sample_at_end(&src_start->val, u * step, words, mode);
+	}
+}
+
+// YUYV to planes: Y of every pixel, U and V of every pixel pair
+FILTER_INLINE void filter_planar(const uint32_t* src, size_t len, uint8_t* y,
+		uint8_t* u, uint8_t* v, i2s_sampling_mode_t mode, size_t unroll,
+		bool aligned) {
+	const size_t words = len / sizeof(uint32_t);
+	const size_t pairs = sample_count(len, mode) / 4;
+	const size_t fast_pairs = words * samples_per_word(mode) / 4;
+	const size_t groups = fast_pairs / (2 * unroll) * unroll;
+	const uint32_t* src_start = src;
+
+	for (size_t i = 0; i < groups; i += unroll) {
+		for (size_t r = 0; r < unroll; ++r) {
+			// camera bytes are Y0 U Y1 V Y2 U Y3 V
+			put32(y, sample_at(src, 0, mode) | (sample_at(src, 2, mode) << 8)
+					| (sample_at(src, 4, mode) << 16)
+					| (sample_at(src, 6, mode) << 24), aligned);
+			u[0] = sample_at(src, 1, mode);
+			u[1] = sample_at(src, 5, mode);
+			v[0] = sample_at(src, 3, mode);
+			v[1] = sample_at(src, 7, mode);
+			src += 8 / samples_per_word(mode);
+			y += 4;
+			u += 2;
+			v += 2;
+		}
+	}
+	// remaining pixel pairs, one at a time
+	src = src_start;
+	for (size_t p = groups * 2; p < pairs; ++p) {
+		*y++ = sample_at_end(src, 4 * p, words, mode);
+		*u++ = sample_at_end(src, 4 * p + 1, words, mode);
+		*y++ = sample_at_end(src, 4 * p + 2, words, mode);
+		*v++ = sample_at_end(src, 4 * p + 3, words, mode);
+	}
+}
+
+#define FILTER_NAME(mode, layout, hdecim, box) \
+		filter_##mode##_##layout##_##hdecim##_##box
+
+#define DMA_FILTER(mode, layout, hdecim, box) \
+static void IRAM_ATTR FILTER_NAME(mode, layout, hdecim, box)( \
+		const dma_elem_t* src, size_t len, uint8_t* dst) { \
+	if (is_aligned(dst)) { \
+		filter(&src->val, len, dst, mode, layout, \
+				CONFIG_CAMERA_FILTER_UNROLL, hdecim, box, true); \
+	} else { \
+		filter(&src->val, len, dst, mode, layout, \
+				CONFIG_CAMERA_FILTER_UNROLL, hdecim, box, false); \
+	} \
+}
+
+#define DMA_FILTER_BYTES(mode, layout, hdecim, box) \
+static void IRAM_ATTR FILTER_NAME(mode, layout, hdecim, box)( \
+		const dma_elem_t* src, size_t len, uint8_t* dst) { \
+	filter_bytes(src, len, dst, mode, layout); \
+}
+
+#define DMA_FILTER_PLANAR(name, mode) \
+static void IRAM_ATTR name(const dma_elem_t* src, size_t len, \
+		uint8_t* y, uint8_t* u, uint8_t* v) { \
+	if (is_aligned(y)) { \
+		filter_planar(&src->val, len, y, u, v, mode, \
+				CONFIG_CAMERA_FILTER_UNROLL, true); \
+	} else { \
+		filter_planar(&src->val, len, y, u, v, mode, \
+				CONFIG_CAMERA_FILTER_UNROLL, false); \
+	} \
+}
+
+// Instances, as F(mode, layout, hdecim, box). FILTERS_BYTES are one byte
+// per pixel without decimation and made by filter_bytes(), FILTERS_WORDS
+// by filter().
+
+#if FILTER_Y8
+#define FILTERS_Y8(F) \
+	F(SM_0A0B_0C0D, DMA_FILTER_Y8, 1, 0) \
+	F(SM_0A0B_0B0C, DMA_FILTER_Y8, 1, 0)
+#else
+#define FILTERS_Y8(F)
+#endif
+
+#if FILTER_RAW
+#define FILTERS_RAW(F) \
+	F(SM_0A0B_0B0C, DMA_FILTER_RAW, 1, 0)
+#else
+#define FILTERS_RAW(F)
+#endif
+
+#if CONFIG_CAMERA_FILTER_JPEG
+#define FILTERS_JPEG(F) \
+	F(SM_0A00_0B00, DMA_FILTER_RAW, 1, 0)
+#else
+#define FILTERS_JPEG(F)
+#endif
+
+// YUV422 always samples two bytes per word, JPEG only with packed DMA or
+// when the sensor sends YUYV for software JPEG
+#if CONFIG_CAMERA_FILTER_YUV422 \
+		|| (CONFIG_CAMERA_FILTER_JPEG \
+				&& (CONFIG_CAMERA_DMA_PACKED || CONFIG_CAMERA_SOFT_JPEG))
+#define FILTERS_RAW_PACKED(F) \
+	F(SM_0A0B_0C0D, DMA_FILTER_RAW, 1, 0)
+#else
+#define FILTERS_RAW_PACKED(F)
+#endif
+
+#define FILTERS_RGB565_MODE(F, mode, hdecim) \
+	F(mode, DMA_FILTER_BGR888, hdecim, 0) \
+	F(mode, DMA_FILTER_RGB888, hdecim, 0) \
+	F(mode, DMA_FILTER_RGB565_BE, hdecim, 0) \
+	F(mode, DMA_FILTER_RGB565_LE, hdecim, 0)
+
+#if CONFIG_CAMERA_DMA_PACKED
+#define FILTERS_RGB565_PACKED(F, hdecim) \
+	FILTERS_RGB565_MODE(F, SM_0A0B_0C0D, hdecim)
+#else
+#define FILTERS_RGB565_PACKED(F, hdecim)
+#endif
+
+#define FILTERS_RGB565_DECIM(F, hdecim) \
+	FILTERS_RGB565_MODE(F, SM_0A0B_0B0C, hdecim) \
+	FILTERS_RGB565_MODE(F, SM_0A00_0B00, hdecim) \
+	FILTERS_RGB565_PACKED(F, hdecim)
+
+#if CONFIG_CAMERA_FILTER_RGB565
+#define FILTERS_RGB565(F)  FILTERS_RGB565_DECIM(F, 1)
+#else
+#define FILTERS_RGB565(F)
+#endif
+
+#define FILTERS_GRAYSCALE_DECIM(F, hdecim) \
+	F(SM_0A0B_0C0D, DMA_FILTER_Y8, hdecim, 0) \
+	F(SM_0A0B_0B0C, DMA_FILTER_Y8, hdecim, 0) \
+	F(SM_0A0B_0C0D, DMA_FILTER_Y8, hdecim, 1) \
+	F(SM_0A0B_0B0C, DMA_FILTER_Y8, hdecim, 1)
+
+#if CONFIG_CAMERA_FILTER_DECIMATION && CONFIG_CAMERA_FILTER_GRAYSCALE
+#define FILTERS_GRAYSCALE_DECIMATED(F) \
+	FILTERS_GRAYSCALE_DECIM(F, 2) FILTERS_GRAYSCALE_DECIM(F, 4)
+#else
+#define FILTERS_GRAYSCALE_DECIMATED(F)
+#endif
+
+#if CONFIG_CAMERA_FILTER_DECIMATION && CONFIG_CAMERA_FILTER_RGB565
+#define FILTERS_RGB565_DECIMATED(F) \
+	FILTERS_RGB565_DECIM(F, 2) FILTERS_RGB565_DECIM(F, 4)
+#else
+#define FILTERS_RGB565_DECIMATED(F)
+#endif
+
+#define FILTERS_BYTES(F)  FILTERS_Y8(F) FILTERS_RAW(F) FILTERS_JPEG(F) \
+	FILTERS_RAW_PACKED(F)
+#define FILTERS_WORDS(F)  FILTERS_RGB565(F) FILTERS_GRAYSCALE_DECIMATED(F) \
+	FILTERS_RGB565_DECIMATED(F)
+#define FILTERS(F)  FILTERS_BYTES(F) FILTERS_WORDS(F)
+
+FILTERS_BYTES(DMA_FILTER_BYTES)
+FILTERS_WORDS(DMA_FILTER)
+
+#if CONFIG_CAMERA_FILTER_YUV422
+DMA_FILTER_PLANAR(filter_0c0d_planar, SM_0A0B_0C0D)
+DMA_FILTER_PLANAR(filter_0b0c_planar, SM_0A0B_0B0C)
+#endif
+
+typedef struct {
+	i2s_sampling_mode_t mode;
+	dma_filter_layout_t layout;
+	uint8_t hdecim;
+	bool box;
+	dma_filter_t filter;
+} dma_filter_entry_t;
+
+#define FILTER_ENTRY(mode, layout, hdecim, box) \
+	{ mode, layout, hdecim, box, &FILTER_NAME(mode, layout, hdecim, box) },
+
+static const dma_filter_entry_t s_filters[] = {
+	FILTERS(FILTER_ENTRY)
+	{ 0, 0, 0, false, NULL }
+};
+
+dma_filter_t dma_filter_get(i2s_sampling_mode_t mode,
+		dma_filter_layout_t layout, size_t hdecim, bool box) {
+	for (const dma_filter_entry_t* e = s_filters; e->filter != NULL; ++e) {
+		if (e->mode == mode && e->layout == layout && e->hdecim == hdecim
+				&& e->box == box) {
+			return e->filter;
+		}
+	}
+	return NULL;
+}
+
+dma_filter_planar_t dma_filter_planar_get(i2s_sampling_mode_t mode) {
+#if CONFIG_CAMERA_FILTER_YUV422
+	if (mode == SM_0A0B_0C0D) {
+		return &filter_0c0d_planar;
+	}
+	if (mode == SM_0A0B_0B0C) {
+		return &filter_0b0c_planar;
+	}
+#endif
+	return NULL;
+}
@@ -0,0 +1,88 @@
+// Copyright 2015-2016 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef union {
+    struct {
+        uint8_t sample2;
+        uint8_t unused2;
+        uint8_t sample1;
+        uint8_t unused1;
+    };
+    uint32_t val;
+} dma_elem_t;
+
+typedef enum {
+    /* camera sends byte sequence: s1, s2, s3, s4, ...
+     * fifo receives: 00 s1 00 s2, 00 s2 00 s3, 00 s3 00 s4, ...
+     */
+    SM_0A0B_0B0C = 0,
+    /* camera sends byte sequence: s1, s2, s3, s4, ...
+     * fifo receives: 00 s1 00 s2, 00 s3 00 s4, ...
+     */
+    SM_0A0B_0C0D = 1,
+    /* camera sends byte sequence: s1, s2, s3, s4, ...
+     * fifo receives: 00 s1 00 00, 00 s2 00 00, 00 s3 00 00, ...
+     */
+    SM_0A00_0B00 = 3,
+} i2s_sampling_mode_t;
+
+/**
+ * Filters convert the samples of one DMA buffer of len bytes (the length
+ * of its lldesc_t) into frame buffer format. DMA buffers are word aligned.
+ * Frame buffer data is written with aligned 32-bit stores when dst is word
+ * aligned, and byte by byte otherwise. Y8 and RAW filters without
+ * decimation always write byte by byte.
+ *
+ * Filters depend on nothing but this header, so dma_filter.c also builds
+ * for the host (without ESP_PLATFORM every format is compiled in).
+ */
+typedef void (*dma_filter_t)(const dma_elem_t* src, size_t len, uint8_t* dst);
+
+/**
+ * Planar filters write luma to y and chroma to u and v, at half the
+ * horizontal resolution. Chroma planes are byte aligned.
+ */
+typedef void (*dma_filter_planar_t)(const dma_elem_t* src, size_t len,
+        uint8_t* y, uint8_t* u, uint8_t* v);
+
+/* Frame buffer layouts produced by filters */
+typedef enum {
+    DMA_FILTER_Y8,          /* luma of YUYV data, 1 byte per pixel */
+    DMA_FILTER_RAW,         /* camera bytes as is: JPEG, YUYV */
+    DMA_FILTER_BGR888,      /* RGB565 to 3 bytes per pixel, blue first */
+    DMA_FILTER_RGB888,      /* RGB565 to 3 bytes per pixel, red first */
+    DMA_FILTER_RGB565_BE,   /* RGB565 as sent by the camera, high byte first */
+    DMA_FILTER_RGB565_LE,   /* RGB565 as uint16_t on a little-endian CPU */
+} dma_filter_layout_t;
+
+/**
+ * Get the filter for the given sampling mode and frame buffer layout.
+ * With hdecim 2 or 4 the filter keeps one pixel out of hdecim, or with box
+ * set (Y8 only), their average. Returns NULL if that combination is not
+ * compiled in (see menuconfig).
+ */
+dma_filter_t dma_filter_get(i2s_sampling_mode_t mode, dma_filter_layout_t layout,
+        size_t hdecim, bool box);
+
+/**
+ * Get the YUYV to planar filter for the given sampling mode.
+ * Returns NULL if YUV422 support is not compiled in.
+ */
+dma_filter_planar_t dma_filter_planar_get(i2s_sampling_mode_t mode);
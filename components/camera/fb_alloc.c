@@ -0,0 +1,162 @@
+// Copyright 2015-2016 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <string.h>
+#include "fb_alloc.h"
+
+#define STATIC_ALIGN 4
+
+void fb_alloc_init(fb_allocator_t* a, const fb_heap_ops_t* heap,
+		const fb_policy_t* chain, uint8_t* static_buf, size_t static_size) {
+	memset(a, 0, sizeof(*a));
+	a->heap = heap;
+	for (size_t i = 0; i < FB_CHAIN_MAX && chain[i] != FB_POLICY_NONE; ++i) {
+		a->chain[i] = chain[i];
+	}
+	if (a->chain[0] == FB_POLICY_NONE) {
+		a->chain[0] = FB_POLICY_INTERNAL;
+	}
+	// keep blocks carved from the static buffer word aligned
+	size_t skip = (STATIC_ALIGN - (uintptr_t) static_buf % STATIC_ALIGN)
+			% STATIC_ALIGN;
+	if (static_buf != NULL && static_size > skip) {
+		a->static_buf = static_buf + skip;
+		a->static_size = static_size - skip;
+	}
+}
+
+static size_t static_free(const fb_allocator_t* a) {
+	return a->static_size - a->static_used;
+}
+
+static size_t static_span(size_t size) {
+	return (size + STATIC_ALIGN - 1) & ~(STATIC_ALIGN - 1);
+}
+
+// Try a single policy, NULL if it can not hold size bytes
+static void* policy_alloc(fb_allocator_t* a, fb_policy_t policy, size_t size) {
+	fb_policy_stats_t* st = &a->stats[policy];
+	void* ptr = NULL;
+	if (policy == FB_POLICY_STATIC) {
+		st->largest_free = static_free(a);
+		if (size <= st->largest_free) {
+			ptr = a->static_buf + a->static_used;
+			a->static_used += static_span(size);
+			if (a->static_used > a->static_size) {
+				a->static_used = a->static_size;
+			}
+			a->static_blocks++;
+			memset(ptr, 0, size);
+		}
+	} else {
+		st->largest_free = a->heap->largest_free(policy);
+		ptr = a->heap->alloc(policy, size);
+		if (ptr != NULL) {
+			memset(ptr, 0, size);
+		}
+	}
+	if (ptr == NULL) {
+		st->failures++;
+		return NULL;
+	}
+	st->bytes += size;
+	st->allocs++;
+	return ptr;
+}
+
+bool fb_alloc(fb_allocator_t* a, size_t size, fb_block_t* block) {
+	for (size_t i = 0; i < FB_CHAIN_MAX && a->chain[i] != FB_POLICY_NONE;
+			++i) {
+		void* ptr = policy_alloc(a, a->chain[i], size);
+		if (ptr != NULL) {
+			block->ptr = ptr;
+			block->size = size;
+			block->policy = a->chain[i];
+			return true;
+		}
+	}
+	block->ptr = NULL;
+	block->size = 0;
+	block->policy = FB_POLICY_NONE;
+	return false;
+}
+
+// Resize a static block without moving it
+static bool static_resize(fb_allocator_t* a, fb_block_t* block, size_t size) {
+	if (size <= block->size) {
+		// keep the whole block, a later resize may grow into it again
+		return true;
+	}
+	size_t start = (uint8_t*) block->ptr - a->static_buf;
+	if (start + static_span(block->size) != a->static_used
+			|| start + static_span(size) > a->static_size) {
+		return false;
+	}
+	a->static_used = start + static_span(size);
+	a->stats[FB_POLICY_STATIC].bytes += size - block->size;
+	block->size = size;
+	return true;
+}
+
+bool fb_realloc(fb_allocator_t* a, fb_block_t* block, size_t size) {
+	if (block->policy == FB_POLICY_STATIC && static_resize(a, block, size)) {
+		return true;
+	}
+	// contents are not kept, so a shrinking heap block is freed first and
+	// its space can hold the new one
+	fb_block_t old = *block;
+	bool shrink = block->policy != FB_POLICY_STATIC && size <= block->size;
+	if (shrink) {
+		fb_free(a, block);
+	}
+	for (size_t i = 0; i < FB_CHAIN_MAX && a->chain[i] != FB_POLICY_NONE;
+			++i) {
+		if (a->chain[i] == FB_POLICY_STATIC) {
+			continue;
+		}
+		void* ptr = policy_alloc(a, a->chain[i], size);
+		if (ptr != NULL) {
+			fb_free(a, block);
+			block->ptr = ptr;
+			block->size = size;
+			block->policy = a->chain[i];
+			return true;
+		}
+	}
+	if (shrink && old.policy != FB_POLICY_NONE) {
+		// the freed space was taken meanwhile, get back what we had if we can
+		block->ptr = policy_alloc(a, old.policy, old.size);
+		if (block->ptr != NULL) {
+			block->size = old.size;
+			block->policy = old.policy;
+		}
+	}
+	return false;
+}
+
+void fb_free(fb_allocator_t* a, fb_block_t* block) {
+	if (block->policy == FB_POLICY_NONE) {
+		return;
+	}
+	if (block->policy == FB_POLICY_STATIC) {
+		if (--a->static_blocks == 0) {
+			a->static_used = 0;
+		}
+	} else {
+		a->heap->free(block->policy, block->ptr);
+	}
+	a->stats[block->policy].bytes -= block->size;
+	block->ptr = NULL;
+	block->size = 0;
+	block->policy = FB_POLICY_NONE;
+}
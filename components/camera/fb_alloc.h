@@ -0,0 +1,98 @@
+// Copyright 2015-2016 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * Frame buffer allocator. Frame buffers are placed by the first policy of
+ * a chain which can hold them. Heaps are reached through fb_heap_ops_t
+ * only, so fb_alloc.c builds for the host against a mock heap.
+ */
+
+/* Placement policies, same values as camera_fb_alloc_policy_t */
+typedef enum {
+    FB_POLICY_NONE = 0,         /* ends a chain */
+    FB_POLICY_INTERNAL = 1,     /* internal DMA capable RAM */
+    FB_POLICY_SPIRAM = 2,       /* external SPI RAM */
+    FB_POLICY_STATIC = 3,       /* buffer provided by the caller */
+    FB_POLICY_COUNT
+} fb_policy_t;
+
+#define FB_CHAIN_MAX 3
+
+/* Heaps behind FB_POLICY_INTERNAL and FB_POLICY_SPIRAM */
+typedef struct {
+    void* (*alloc)(fb_policy_t heap, size_t size);  /* NULL if it does not fit */
+    void (*free)(fb_policy_t heap, void* ptr);
+    size_t (*largest_free)(fb_policy_t heap);
+} fb_heap_ops_t;
+
+/* Same fields as camera_fb_alloc_stats_t */
+typedef struct {
+    size_t bytes;               /* bytes currently allocated */
+    size_t allocs;              /* successful allocations */
+    size_t failures;            /* allocations this policy could not hold */
+    size_t largest_free;        /* largest free block at the last attempt */
+} fb_policy_stats_t;
+
+typedef struct {
+    void* ptr;
+    size_t size;
+    fb_policy_t policy;         /* FB_POLICY_NONE if not allocated */
+} fb_block_t;
+
+typedef struct {
+    const fb_heap_ops_t* heap;
+    fb_policy_t chain[FB_CHAIN_MAX];
+    uint8_t* static_buf;
+    size_t static_size;
+    size_t static_used;         /* static space is handed out in order... */
+    size_t static_blocks;       /* ... and reclaimed once all of it is freed */
+    fb_policy_stats_t stats[FB_POLICY_COUNT];
+} fb_allocator_t;
+
+/**
+ * Set up an allocator. An empty chain (first entry FB_POLICY_NONE) means
+ * internal RAM only. static_buf may be NULL if the chain does not use
+ * FB_POLICY_STATIC.
+ */
+void fb_alloc_init(fb_allocator_t* a, const fb_heap_ops_t* heap,
+        const fb_policy_t* chain, uint8_t* static_buf, size_t static_size);
+
+/**
+ * Allocate size bytes, zeroed, from the first policy of the chain which
+ * can hold them. Returns false, with block->policy FB_POLICY_NONE, if
+ * none can.
+ */
+bool fb_alloc(fb_allocator_t* a, size_t size, fb_block_t* block);
+
+/**
+ * Resize an allocated block to size bytes, its contents are not kept.
+ * A static block stays in place if it can hold size bytes, or grow there
+ * if it was carved last. Otherwise the block moves to the first heap of
+ * the chain which can hold it: resizing never carves static space, which
+ * is only reclaimed once every static block is freed. A heap block which
+ * shrinks is freed before the new one is allocated. Returns false if size
+ * bytes can not be placed: the block is unchanged, or, in the unlikely case
+ * that the freed space of a shrinking block was taken meanwhile, it may be
+ * left unallocated (FB_POLICY_NONE, ptr NULL).
+ */
+bool fb_realloc(fb_allocator_t* a, fb_block_t* block, size_t size);
+
+/* Release a block, does nothing for a block which was not allocated */
+void fb_free(fb_allocator_t* a, fb_block_t* block);
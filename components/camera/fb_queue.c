@@ -0,0 +1,65 @@
+// Copyright 2015-2016 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "fb_queue.h"
+
+bool fb_queue_create(fb_queue_t* q, size_t count) {
+	q->free = xQueueCreate(count, sizeof(void*));
+	q->filled = xQueueCreate(count, sizeof(void*));
+	return q->free != NULL && q->filled != NULL;
+}
+
+void fb_queue_delete(fb_queue_t* q) {
+	if (q->free) {
+		vQueueDelete(q->free);
+	}
+	if (q->filled) {
+		vQueueDelete(q->filled);
+	}
+	q->free = NULL;
+	q->filled = NULL;
+}
+
+void fb_queue_reset(fb_queue_t* q) {
+	xQueueReset(q->free);
+	xQueueReset(q->filled);
+}
+
+void fb_queue_release(fb_queue_t* q, void* buf) {
+	xQueueSend(q->free, &buf, 0);
+}
+
+void* fb_queue_get(fb_queue_t* q, TickType_t timeout) {
+	void* buf = NULL;
+	if (xQueueReceive(q->filled, &buf, timeout) != pdTRUE) {
+		return NULL;
+	}
+	return buf;
+}
+
+void* fb_queue_frame_done(fb_queue_t* q, void* done, size_t* dropped) {
+	void* next = NULL;
+	if (xQueueReceive(q->free, &next, 0) != pdTRUE) {
+		// consumer holds the other buffers, recycle the oldest filled frame
+		if (xQueueReceive(q->filled, &next, 0) == pdTRUE) {
+			(*dropped)++;
+		}
+	}
+	if (next == NULL) {
+		// nothing to switch to, capture over the frame just completed
+		(*dropped)++;
+		return done;
+	}
+	xQueueSend(q->filled, &done, 0);
+	return next;
+}
@@ -0,0 +1,57 @@
+// Copyright 2015-2016 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+/**
+ * Hand-off of pool frame buffers between capture and the consumer while
+ * streaming. Buffers are opaque pointers passed through two FreeRTOS
+ * queues. Nothing else is used, so fb_queue.c builds for the host against
+ * a queue shim and the recycling policy is tested there.
+ */
+typedef struct {
+    QueueHandle_t free;         /* buffers capture may switch to */
+    QueueHandle_t filled;       /* completed frames, oldest first */
+} fb_queue_t;
+
+/**
+ * Create the queues for count buffers. Returns false if out of memory,
+ * fb_queue_delete cleans up in either case.
+ */
+bool fb_queue_create(fb_queue_t* q, size_t count);
+
+void fb_queue_delete(fb_queue_t* q);
+
+/* Empty both queues, the caller owns every buffer again */
+void fb_queue_reset(fb_queue_t* q);
+
+/* Make a buffer available to capture, at setup or once the consumer is done with it */
+void fb_queue_release(fb_queue_t* q, void* buf);
+
+/* Oldest completed frame, NULL if none arrives within timeout ticks */
+void* fb_queue_get(fb_queue_t* q, TickType_t timeout);
+
+/**
+ * Capture completed the frame in done: queue it for the consumer and
+ * return the buffer capture continues with. That is a free buffer or,
+ * if the consumer holds all of them, the oldest completed frame, which
+ * is dropped. If there is neither, done is returned without being queued
+ * and its frame is dropped. *dropped is incremented for a dropped frame.
+ */
+void* fb_queue_frame_done(fb_queue_t* q, void* done, size_t* dropped);
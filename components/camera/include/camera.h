@@ -14,6 +14,9 @@
 
 #pragma once
 
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
 #include "esp_err.h"
 #include "driver/ledc.h"
 
@@ -22,12 +25,21 @@ extern "C" {
 #endif
 
 typedef enum {
-    CAMERA_PF_RGB565 = 0,       //!< RGB, 2 bytes per pixel (not implemented)
-    CAMERA_PF_YUV422 = 1,       //!< YUYV, 2 bytes per pixel (not implemented)
+    CAMERA_PF_RGB565 = 0,       //!< RGB, see camera_fb_layout_t for frame buffer layouts
+    CAMERA_PF_YUV422 = 1,       //!< YUYV, 2 bytes per pixel, or planar I420 (see camera_fb_layout_t)
     CAMERA_PF_GRAYSCALE = 2,    //!< 1 byte per pixel
-    CAMERA_PF_JPEG = 3,         //!< JPEG compressed
+    CAMERA_PF_JPEG = 3,         //!< JPEG compressed, in software on sensors other than OV2640 (CONFIG_CAMERA_SOFT_JPEG)
 } camera_pixelformat_t;
 
+typedef enum {
+    CAMERA_FB_LAYOUT_DEFAULT = 0,   //!< Default layout of the pixel format (BGR888 for RGB565, YUYV for YUV422)
+    CAMERA_FB_LAYOUT_BGR888 = 1,    //!< 3 bytes per pixel: blue, green, red (as in BMP files)
+    CAMERA_FB_LAYOUT_RGB888 = 2,    //!< 3 bytes per pixel: red, green, blue
+    CAMERA_FB_LAYOUT_RGB565_BE = 3, //!< 2 bytes per pixel, high byte first, as sent by the camera
+    CAMERA_FB_LAYOUT_RGB565_LE = 4, //!< 2 bytes per pixel, low byte first (uint16_t on ESP32)
+    CAMERA_FB_LAYOUT_I420 = 5,      //!< YUV422 as planar 4:2:0: Y plane, then U and V planes at half width and height
+} camera_fb_layout_t;
+
 typedef enum {
     CAMERA_FS_QQVGA = 4,     //!< 160x120
     CAMERA_FS_QVGA = 8,      //!< 320x240
@@ -37,6 +49,22 @@ typedef enum {
 	CAMERA_FS_UXGA=13,		//1600*1200
 } camera_framesize_t;
 
+typedef enum {
+    CAMERA_DECIMATE_SKIP = 0,   //!< Keep one pixel out of each block
+    CAMERA_DECIMATE_BOX = 1,    //!< Average each block (grayscale only)
+} camera_decimation_mode_t;
+
+#define CAMERA_PYRAMID_LEVELS_MAX 2     //!< Downscaled levels a grayscale frame can carry, 1/2 and 1/4
+
+typedef enum {
+    CAMERA_FB_ALLOC_NONE = 0,       //!< Ends a chain of policies
+    CAMERA_FB_ALLOC_INTERNAL = 1,   //!< Internal DMA capable RAM
+    CAMERA_FB_ALLOC_SPIRAM = 2,     //!< External SPI RAM (CONFIG_SPIRAM_SUPPORT)
+    CAMERA_FB_ALLOC_STATIC = 3,     //!< fb_static_buf from camera_config_t
+} camera_fb_alloc_policy_t;
+
+#define CAMERA_FB_ALLOC_CHAIN_MAX 3
+
 typedef enum {
     CAMERA_NONE = 0,
     CAMERA_UNKNOWN = 1,
@@ -44,6 +72,21 @@ typedef enum {
     CAMERA_OV2640 = 2640,
 } camera_model_t;
 
+/**
+ * @brief Callback receiving filtered lines, in frame buffer format
+ *
+ * Called from the DMA filter task for every line, in order. Line 0 starts
+ * a new frame. The data is only valid during the call when no frame buffer
+ * is used, so it has to be consumed or copied before returning. A slow
+ * callback makes the filter fall behind DMA (see camera_stats_t).
+ *
+ * @param data  line data
+ * @param len   length of line data, in bytes
+ * @param line  line index in the frame
+ * @param arg   line_cb_arg from camera_config_t
+ */
+typedef void (*camera_line_cb_t)(const uint8_t* data, size_t len, size_t line, void* arg);
+
 typedef struct {
     int pin_reset;          /*!< GPIO pin for camera reset line */
     int pin_xclk;           /*!< GPIO pin for camera XCLK line */
@@ -68,14 +111,62 @@ typedef struct {
 
     camera_pixelformat_t pixel_format;
     camera_framesize_t frame_size;
+    camera_fb_layout_t fb_layout;   /*!< Frame buffer layout, only RGB565 and YUV422 have a choice of layouts */
+    int decimation;                 /*!< Downscale by 2 or 4 in both directions while filtering, 0 or 1 for none (grayscale and RGB565) */
+    camera_decimation_mode_t decimation_mode;   /*!< How pixels are decimated */
+    int pyramid_levels;             /*!< Grayscale only: also fill 1, 2 downscaled levels (1/2, 1/4 size) of each frame */
+
+    int jpeg_quality;               /*!< 0 (best) to 63 (smallest), the OV2640 QS scale, also for software JPEG */
+    size_t jpeg_target_size;        /*!< Rate control: target JPEG bytes per frame, starting from jpeg_quality (0: fixed jpeg_quality) */
 
-    int jpeg_quality;
+    int fb_count;           /*!< Number of frame buffers used in streaming mode (at least 2 to stream) */
+    camera_fb_alloc_policy_t fb_alloc[CAMERA_FB_ALLOC_CHAIN_MAX];  /*!< Where frame buffers go, policies tried in order (none: internal RAM) */
+    uint8_t* fb_static_buf; /*!< Memory for CAMERA_FB_ALLOC_STATIC, must outlive the driver */
+    size_t fb_static_size;  /*!< Size of fb_static_buf, in bytes */
+
+    int dma_lines;          /*!< Depth of the DMA descriptor ring, in lines (0: CONFIG_CAMERA_DMA_LINES) */
+    int dma_buf_max;        /*!< Largest DMA buffer, in bytes (0: CONFIG_CAMERA_DMA_BUF_MAX) */
+
+    camera_line_cb_t line_cb;   /*!< Optional, called with every filtered line (not for JPEG) */
+    void* line_cb_arg;          /*!< Argument passed to line_cb */
+    bool fb_disabled;           /*!< Do not allocate frame buffers, deliver lines to line_cb only */
 } camera_config_t;
 
+typedef struct {
+    uint8_t* buf;                   /*!< Pointer to frame data */
+    size_t len;                     /*!< Length of valid data in buf, in bytes */
+    size_t size;                    /*!< Capacity of buf, in bytes */
+    size_t width;                   /*!< Width of the frame, in pixels */
+    size_t height;                  /*!< Height of the frame, in pixels */
+    camera_pixelformat_t format;    /*!< Pixel format of the frame */
+    size_t seq;                     /*!< Frame sequence number */
+    bool truncated;                 /*!< JPEG frame did not fit into buf and was cut short */
+    uint8_t* pyramid[CAMERA_PYRAMID_LEVELS_MAX];   /*!< Level i is the frame at 1/2^(i+1) width and height, 2x2 averaged, NULL if not enabled */
+} camera_fb_t;
+
+typedef struct {
+    size_t frames;                  /*!< Number of frames captured */
+    size_t frames_dropped;          /*!< Frames overwritten because no buffer was free, or discarded after lost lines */
+    size_t frames_truncated;        /*!< JPEG frames which did not fit into the frame buffer */
+    size_t dma_overruns;            /*!< DMA buffers lost because the filter task fell too far behind */
+    size_t dma_lag_max;             /*!< Most DMA buffers received but not yet filtered at any time */
+    uint64_t vsync_wait_us;         /*!< Time spent blocked waiting for VSYNC, in microseconds (CPU time left to other tasks) */
+    size_t capture_memory;          /*!< Bytes of the DMA capable block holding DMA descriptors and buffers (frame buffers: see camera_get_fb_alloc_stats) */
+    int jpeg_quality;               /*!< JPEG quality (QS) in use, moved by rate control; -1 for other formats */
+} camera_stats_t;
+
+typedef struct {
+    size_t bytes;                   /*!< Bytes of frame buffers currently placed by the policy */
+    size_t allocs;                  /*!< Frame buffers placed by the policy */
+    size_t failures;                /*!< Frame buffers the policy could not hold */
+    size_t largest_free;            /*!< Largest free block of the policy at its last attempt */
+} camera_fb_alloc_stats_t;
+
 #define ESP_ERR_CAMERA_BASE 0x20000
 #define ESP_ERR_CAMERA_NOT_DETECTED             (ESP_ERR_CAMERA_BASE + 1)
 #define ESP_ERR_CAMERA_FAILED_TO_SET_FRAME_SIZE (ESP_ERR_CAMERA_BASE + 2)
 #define ESP_ERR_CAMERA_NOT_SUPPORTED            (ESP_ERR_CAMERA_BASE + 3)
+#define ESP_ERR_CAMERA_FRAME_TRUNCATED          (ESP_ERR_CAMERA_BASE + 4)
 
 /**
  * @brief Probe the camera
@@ -117,10 +208,22 @@ esp_err_t camera_deinit();
 /**
  * @brief Obtain the pointer to framebuffer allocated by camera_init function.
  *
- * @return pointer to framebuffer
+ * @return pointer to framebuffer, NULL if fb_disabled is set
  */
 uint8_t* camera_get_fb();
 
+/**
+ * @brief Obtain a downscaled level of the frame captured by camera_run
+ *
+ * Levels are filled in the same pass as the frame buffer, see
+ * pyramid_levels in camera_config_t. Level 1 is half the width and height
+ * of the frame buffer, level 2 a quarter.
+ *
+ * @param level  1 to pyramid_levels
+ * @return pointer to the level, NULL if it is not enabled
+ */
+uint8_t* camera_get_pyramid(int level);
+
 /**
  * @brief Return the size of valid data in the framebuffer
  *
@@ -149,10 +252,218 @@ int camera_get_fb_height();
  * and blocks until all lines of the image are stored into the framebuffer.
  * Once all lines are stored, the function returns.
  *
- * @return ESP_OK on success
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_CAMERA_FRAME_TRUNCATED if a JPEG frame did not fit into the
+ *        framebuffer; the data which did fit is kept
+ *      - ESP_ERR_INVALID_STATE if not initialized, streaming, or capture
+ *        memory was lost to a failed reconfiguration
  */
 esp_err_t camera_run();
 
+/**
+ * @brief Start continuous capture into the frame buffer pool
+ *
+ * Frames are captured back to back into the camera_config_t::fb_count
+ * frame buffers allocated by camera_init. Filled frames are obtained with
+ * camera_fb_get and must be handed back with camera_fb_return.
+ * If the consumer holds every buffer, the oldest filled frame is
+ * overwritten and counted in camera_stats_t::frames_dropped.
+ *
+ * camera_run can not be used while streaming.
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_STATE if the driver is not initialized, already
+ *        streaming, or capture memory was lost to a failed reconfiguration
+ *      - ESP_ERR_NOT_SUPPORTED if fewer than two frame buffers were configured
+ */
+esp_err_t camera_stream_start();
+
+/**
+ * @brief Stop continuous capture
+ *
+ * Blocks until the frame in flight has been captured. Frames which were
+ * already filled can still be obtained with camera_fb_get.
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_STATE if the driver is not streaming
+ */
+esp_err_t camera_stream_stop();
+
+/**
+ * @brief Obtain the oldest filled frame buffer
+ *
+ * @param timeout_ms  time to wait for a frame, in milliseconds
+ * @return pointer to the frame buffer, or NULL on timeout
+ */
+camera_fb_t* camera_fb_get(uint32_t timeout_ms);
+
+/**
+ * @brief Return a frame buffer obtained with camera_fb_get to the pool
+ *
+ * @param fb  frame buffer to return
+ */
+void camera_fb_return(camera_fb_t* fb);
+
+/**
+ * @brief Pick the smallest DMA descriptor ring which the filter keeps up with
+ *
+ * Rebuilds the ring with max_lines lines, captures a number of frames while
+ * measuring how far the filter task falls behind DMA, then rebuilds the
+ * ring with just enough lines to hold that lag plus one line of margin.
+ * Run it at the XCLK frequency and pixel format which will be used.
+ *
+ * @param frames     number of frames to capture
+ * @param max_lines  ring depth to measure with, in lines
+ * @param[out] out_lines  optional output, ring depth chosen, in lines
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_STATE if the driver is not initialized or streaming
+ *      - ESP_ERR_INVALID_SIZE if DMA overran even with max_lines lines
+ *      - ESP_ERR_NO_MEM if the ring could not be allocated
+ *      - any error of camera_run while capturing
+ *
+ * On any error the previous ring depth and capture memory are restored.
+ * Only if that memory can not be allocated again either does capture fail
+ * with ESP_ERR_INVALID_STATE; deinitialize the driver then.
+ */
+esp_err_t camera_calibrate_dma(int frames, int max_lines, int* out_lines);
+
+/**
+ * @brief Capture only a window of the frame
+ *
+ * Lines outside the window are dropped and only the columns inside it are
+ * filtered. Frame buffers are reallocated to the size of the window, so
+ * buffers obtained before become invalid and all of them have to be
+ * returned first. Not available for JPEG, I420 or decimated frames.
+ *
+ * @param x  left edge, in pixels of the configured frame size
+ * @param y  top edge
+ * @param w  width, 0 to capture the whole frame again
+ * @param h  height, 0 to capture the whole frame again
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_STATE if not initialized or streaming
+ *      - ESP_ERR_INVALID_ARG if the window does not fit the frame
+ *      - ESP_ERR_NOT_SUPPORTED for formats which can not be cropped
+ *      - ESP_ERR_NO_MEM if frame buffers could not be allocated; the
+ *        previous region and its memory are restored. Only if that memory
+ *        can not be allocated again either does capture fail with
+ *        ESP_ERR_INVALID_STATE; deinitialize the driver then.
+ */
+esp_err_t camera_set_roi(int x, int y, int w, int h);
+
+/**
+ * @brief Make the sensor send only a window of the frame
+ *
+ * Unlike camera_set_roi, pixels outside the window are never sent by the
+ * sensor, so lines are shorter and frames arrive faster. The window is in
+ * pixels of the configured frame size: the sensor scales it down from its
+ * pixel array by the same factor as the whole frame, so a w x h window
+ * arrives as w x h pixels showing what it shows in a full frame. DMA and frame
+ * buffers are reallocated for the window, and any region of interest is
+ * reset to the whole window. For JPEG, the frame buffer size estimate and
+ * the software encoder are set up again for the window size.
+ *
+ * @param x  left edge
+ * @param y  top edge
+ * @param w  width, a multiple of 4, 0 for the whole frame
+ * @param h  height, a multiple of 4, 0 for the whole frame
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_STATE if not initialized or streaming
+ *      - ESP_ERR_INVALID_ARG if the window does not fit the frame
+ *      - ESP_ERR_NOT_SUPPORTED if the sensor has no windowing support
+ *      - ESP_ERR_CAMERA_FAILED_TO_SET_FRAME_SIZE if the sensor rejected it
+ *      - ESP_ERR_NO_MEM if buffers could not be allocated
+ *
+ * On an error the previous window, sensor registers included, and region
+ * of interest are restored. As for camera_set_roi, capture fails with
+ * ESP_ERR_INVALID_STATE if even the previous memory can not be allocated.
+ */
+esp_err_t camera_set_window(int x, int y, int w, int h);
+
+/**
+ * @brief Change frame size, pixel format or JPEG quality in place
+ *
+ * Unlike camera_deinit followed by camera_init, the filter tasks,
+ * interrupts and I2S setup are kept, only the sensor registers which
+ * differ from the current configuration are written, and DMA and frame
+ * buffer memory is reused if it fits the new frame. Frame size, pixel
+ * format, frame buffer layout, decimation, pyramid levels, JPEG quality
+ * and JPEG size target may differ from the current configuration; all
+ * other fields have to be the same. Any region of interest or sensor window is reset.
+ *
+ * @param config  new configuration
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_STATE if not initialized or streaming
+ *      - ESP_ERR_INVALID_ARG if a field which can not be reconfigured
+ *        differs, or the new configuration is invalid
+ *      - ESP_ERR_NOT_SUPPORTED if the new format is not supported
+ *      - ESP_ERR_CAMERA_FAILED_TO_SET_FRAME_SIZE if the sensor rejected it
+ *      - ESP_ERR_NO_MEM if buffers could not be allocated
+ *
+ * On any error the previous configuration, sensor window and region of
+ * interest are restored, sensor registers included. Only if the memory
+ * of the previous configuration can not be allocated again either does
+ * capture fail with ESP_ERR_INVALID_STATE; deinitialize the driver then.
+ */
+esp_err_t camera_reconfigure(const camera_config_t* config);
+
+/**
+ * @brief Keep JPEG frames near a size by adjusting quality between frames
+ *
+ * After every frame, QS is raised right away if the frame was larger than
+ * frame_bytes, in proportion to the excess, and lowered one step if it was
+ * smaller by more than CONFIG_CAMERA_JPEG_RATE_BAND percent. Only the QS
+ * register is written, and only when QS changes. The current QS is
+ * reported in camera_stats_t::jpeg_quality.
+ *
+ * @param frame_bytes  target size of a JPEG frame, 0 to stop adjusting
+ *                     (QS stays where it is)
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_STATE if not initialized
+ *      - ESP_ERR_NOT_SUPPORTED if the format is not JPEG
+ */
+esp_err_t camera_set_jpeg_target(size_t frame_bytes);
+
+/**
+ * @brief Rate control for a link bitrate, see camera_set_jpeg_target
+ *
+ * @param bits_per_second  bitrate available for JPEG frames
+ * @param fps  frame rate the bitrate is spread over
+ * @return as camera_set_jpeg_target, or ESP_ERR_INVALID_ARG if fps is not
+ *         positive
+ */
+esp_err_t camera_set_jpeg_bitrate(uint32_t bits_per_second, int fps);
+
+/**
+ * @brief Get capture statistics
+ *
+ * @param[out] out_stats  output, capture statistics
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_STATE if the driver hasn't been initialized yet
+ */
+esp_err_t camera_get_stats(camera_stats_t* out_stats);
+
+/**
+ * @brief Get frame buffer allocation statistics of a placement policy
+ *
+ * @param policy  policy of the fb_alloc chain
+ * @param[out] out_stats  output, statistics of the policy
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_STATE if there are no frame buffers
+ *      - ESP_ERR_INVALID_ARG if policy is not valid
+ */
+esp_err_t camera_get_fb_alloc_stats(camera_fb_alloc_policy_t policy,
+        camera_fb_alloc_stats_t* out_stats);
+
 /**
  * @brief Print contents of framebuffer on terminal
  *
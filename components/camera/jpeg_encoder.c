@@ -0,0 +1,452 @@
+// Copyright 2015-2016 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <string.h>
+#include "jpeg_encoder.h"
+
+// Standard tables of ITU-T T.81 Annex K, quantizers in natural order
+static const uint8_t s_std_qt[2][64] = {
+	{ 16, 11, 10, 16, 24, 40, 51, 61, 12, 12, 14, 19, 26, 58, 60, 55,
+	  14, 13, 16, 24, 40, 57, 69, 56, 14, 17, 22, 29, 51, 87, 80, 62,
+	  18, 22, 37, 56, 68, 109, 103, 77, 24, 35, 55, 64, 81, 104, 113, 92,
+	  49, 64, 78, 87, 103, 121, 120, 101, 72, 92, 95, 98, 112, 100, 103, 99 },
+	{ 17, 18, 24, 47, 99, 99, 99, 99, 18, 21, 26, 66, 99, 99, 99, 99,
+	  24, 26, 56, 99, 99, 99, 99, 99, 47, 66, 99, 99, 99, 99, 99, 99,
+	  99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+	  99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99 },
+};
+
+// natural index of each zigzag position
+static const uint8_t s_zigzag[64] = {
+	0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5,
+	12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28,
+	35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+	58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+static const uint8_t s_dc_bits[2][16] = {
+	{ 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 },
+	{ 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 },
+};
+
+static const uint8_t s_dc_vals[12] = {
+	0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11,
+};
+
+static const uint8_t s_ac_bits[2][16] = {
+	{ 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d },
+	{ 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 },
+};
+
+static const uint8_t s_ac_vals[2][162] = {
+	{ 0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06,
+	  0x13, 0x51, 0x61, 0x07, 0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08,
+	  0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0, 0x24, 0x33, 0x62, 0x72,
+	  0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+	  0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45,
+	  0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59,
+	  0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75,
+	  0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+	  0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3,
+	  0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
+	  0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9,
+	  0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+	  0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4,
+	  0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa },
+	{ 0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41,
+	  0x51, 0x07, 0x61, 0x71, 0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91,
+	  0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0, 0x15, 0x62, 0x72, 0xd1,
+	  0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+	  0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44,
+	  0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,
+	  0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74,
+	  0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+	  0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a,
+	  0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4,
+	  0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7,
+	  0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+	  0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4,
+	  0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa },
+};
+
+// Code and length of each symbol, derived once from the tables above.
+// AC tables are indexed by the run/size symbol, DC tables by the size.
+typedef struct {
+	uint16_t code;
+	uint8_t size;
+} huff_code_t;
+
+static huff_code_t s_dc_codes[2][12];
+static huff_code_t s_ac_codes[2][256];
+static bool s_codes_ready;
+
+static void huff_derive(const uint8_t* bits, const uint8_t* vals,
+		huff_code_t* codes) {
+	uint16_t code = 0;
+	size_t k = 0;
+	for (int len = 1; len <= 16; ++len) {
+		for (int i = 0; i < bits[len - 1]; ++i, ++k) {
+			codes[vals[k]].code = code++;
+			codes[vals[k]].size = len;
+		}
+		code <<= 1;
+	}
+}
+
+void jpeg_enc_init(jpeg_encoder_t* enc, size_t width, size_t height,
+		jpeg_enc_sampling_t sampling, int quality) {
+	if (!s_codes_ready) {
+		for (int t = 0; t < 2; ++t) {
+			huff_derive(s_dc_bits[t], s_dc_vals, s_dc_codes[t]);
+			huff_derive(s_ac_bits[t], s_ac_vals[t], s_ac_codes[t]);
+		}
+		s_codes_ready = true;
+	}
+	memset(enc, 0, sizeof(*enc));
+	enc->width = width;
+	enc->height = height;
+	enc->sampling = sampling;
+	jpeg_enc_set_quality(enc, quality);
+}
+
+void jpeg_enc_set_quality(jpeg_encoder_t* enc, int quality) {
+	quality = (quality < 1) ? 1 : (quality > 100) ? 100 : quality;
+	enc->quality = quality;
+	// IJG quality scaling, 50 gives the standard tables
+	int scale = (quality < 50) ? 5000 / quality : 200 - 2 * quality;
+	for (int t = 0; t < 2; ++t) {
+		for (int i = 0; i < 64; ++i) {
+			int q = (s_std_qt[t][i] * scale + 50) / 100;
+			q = (q < 1) ? 1 : (q > 255) ? 255 : q;
+			enc->qt[t][i] = q;
+			enc->qrecip[t][i] = (65536 + 4 * q) / (8 * q);
+		}
+	}
+}
+
+size_t jpeg_enc_strip_lines(const jpeg_encoder_t* enc) {
+	return (enc->sampling == JPEG_ENC_YUV420) ? 16 : 8;
+}
+
+static void emit_byte(jpeg_encoder_t* enc, uint8_t b) {
+	if (enc->out_len < enc->out_size) {
+		enc->out[enc->out_len++] = b;
+	} else {
+		enc->overflow = true;
+	}
+}
+
+static void emit_word(jpeg_encoder_t* enc, uint16_t w) {
+	emit_byte(enc, w >> 8);
+	emit_byte(enc, w);
+}
+
+// Append the low size bits of code, size at most 16. Fewer than 8 bits
+// are pending between calls, whole bytes go out with 0xff stuffed.
+static inline void put_bits(jpeg_encoder_t* enc, uint32_t code, int size) {
+	enc->bit_count += size;
+	enc->bits |= (code & ((1u << size) - 1)) << (32 - enc->bit_count);
+	while (enc->bit_count >= 8) {
+		uint8_t b = enc->bits >> 24;
+		emit_byte(enc, b);
+		if (b == 0xff) {
+			emit_byte(enc, 0);
+		}
+		enc->bits <<= 8;
+		enc->bit_count -= 8;
+	}
+}
+
+static size_t component_count(const jpeg_encoder_t* enc) {
+	return (enc->sampling == JPEG_ENC_GRAY) ? 1 : 3;
+}
+
+static void write_dht(jpeg_encoder_t* enc, int cls, int id,
+		const uint8_t* bits, const uint8_t* vals) {
+	size_t count = 0;
+	for (int i = 0; i < 16; ++i) {
+		count += bits[i];
+	}
+	emit_word(enc, 0xffc4);
+	emit_word(enc, 2 + 1 + 16 + count);
+	emit_byte(enc, (cls << 4) | id);
+	for (int i = 0; i < 16; ++i) {
+		emit_byte(enc, bits[i]);
+	}
+	for (size_t i = 0; i < count; ++i) {
+		emit_byte(enc, vals[i]);
+	}
+}
+
+void jpeg_enc_begin(jpeg_encoder_t* enc, uint8_t* out, size_t out_size) {
+	enc->out = out;
+	enc->out_size = out_size;
+	enc->out_len = 0;
+	enc->overflow = false;
+	enc->bits = 0;
+	enc->bit_count = 0;
+	memset(enc->dc_pred, 0, sizeof(enc->dc_pred));
+	size_t comps = component_count(enc);
+	size_t tables = (comps == 1) ? 1 : 2;
+
+	emit_word(enc, 0xffd8);
+	// DQT, in zigzag order
+	emit_word(enc, 0xffdb);
+	emit_word(enc, 2 + tables * 65);
+	for (size_t t = 0; t < tables; ++t) {
+		emit_byte(enc, t);
+		for (int k = 0; k < 64; ++k) {
+			emit_byte(enc, enc->qt[t][s_zigzag[k]]);
+		}
+	}
+	// SOF0, luma sampling factors carry the chroma subsampling
+	emit_word(enc, 0xffc0);
+	emit_word(enc, 8 + 3 * comps);
+	emit_byte(enc, 8);
+	emit_word(enc, enc->height);
+	emit_word(enc, enc->width);
+	emit_byte(enc, comps);
+	uint8_t luma_factors = (enc->sampling == JPEG_ENC_YUV420) ? 0x22
+			: (enc->sampling == JPEG_ENC_YUV422) ? 0x21 : 0x11;
+	for (size_t c = 0; c < comps; ++c) {
+		emit_byte(enc, c + 1);
+		emit_byte(enc, (c == 0) ? luma_factors : 0x11);
+		emit_byte(enc, (c == 0) ? 0 : 1);
+	}
+	for (size_t t = 0; t < tables; ++t) {
+		write_dht(enc, 0, t, s_dc_bits[t], s_dc_vals);
+		write_dht(enc, 1, t, s_ac_bits[t], s_ac_vals[t]);
+	}
+	// SOS
+	emit_word(enc, 0xffda);
+	emit_word(enc, 6 + 2 * comps);
+	emit_byte(enc, comps);
+	for (size_t c = 0; c < comps; ++c) {
+		emit_byte(enc, c + 1);
+		emit_byte(enc, (c == 0) ? 0x00 : 0x11);
+	}
+	emit_byte(enc, 0);
+	emit_byte(enc, 63);
+	emit_byte(enc, 0);
+}
+
+// Integer forward DCT, the LL&M algorithm as in the IJG islow DCT.
+// Input is centered on 0, output is scaled up by 8.
+#define CONST_BITS 13
+#define PASS1_BITS 2
+#define DESCALE(x, n) (((x) + (1 << ((n) - 1))) >> (n))
+#define FIX_0_298631336 2446
+#define FIX_0_390180644 3196
+#define FIX_0_541196100 4433
+#define FIX_0_765366865 6270
+#define FIX_0_899976223 7373
+#define FIX_1_175875602 9633
+#define FIX_1_501321110 12299
+#define FIX_1_847759065 15137
+#define FIX_1_961570560 16069
+#define FIX_2_053119869 16819
+#define FIX_2_562915447 20995
+#define FIX_3_072711026 25172
+
+// One 8 point DCT over d[0], d[step], ... d[7 * step]. The first pass
+// keeps PASS1_BITS of extra precision, the second one removes them.
+static inline void fdct_1d(int32_t* d, int step, int first_pass) {
+	int32_t tmp0 = d[0] + d[7 * step];
+	int32_t tmp7 = d[0] - d[7 * step];
+	int32_t tmp1 = d[step] + d[6 * step];
+	int32_t tmp6 = d[step] - d[6 * step];
+	int32_t tmp2 = d[2 * step] + d[5 * step];
+	int32_t tmp5 = d[2 * step] - d[5 * step];
+	int32_t tmp3 = d[3 * step] + d[4 * step];
+	int32_t tmp4 = d[3 * step] - d[4 * step];
+
+	int32_t tmp10 = tmp0 + tmp3;
+	int32_t tmp13 = tmp0 - tmp3;
+	int32_t tmp11 = tmp1 + tmp2;
+	int32_t tmp12 = tmp1 - tmp2;
+	int shift = first_pass ? CONST_BITS - PASS1_BITS : CONST_BITS + PASS1_BITS;
+	if (first_pass) {
+		d[0] = (tmp10 + tmp11) << PASS1_BITS;
+		d[4 * step] = (tmp10 - tmp11) << PASS1_BITS;
+	} else {
+		d[0] = DESCALE(tmp10 + tmp11, PASS1_BITS);
+		d[4 * step] = DESCALE(tmp10 - tmp11, PASS1_BITS);
+	}
+	int32_t z1 = (tmp12 + tmp13) * FIX_0_541196100;
+	d[2 * step] = DESCALE(z1 + tmp13 * FIX_0_765366865, shift);
+	d[6 * step] = DESCALE(z1 - tmp12 * FIX_1_847759065, shift);
+
+	z1 = tmp4 + tmp7;
+	int32_t z2 = tmp5 + tmp6;
+	int32_t z3 = tmp4 + tmp6;
+	int32_t z4 = tmp5 + tmp7;
+	int32_t z5 = (z3 + z4) * FIX_1_175875602;
+	tmp4 *= FIX_0_298631336;
+	tmp5 *= FIX_2_053119869;
+	tmp6 *= FIX_3_072711026;
+	tmp7 *= FIX_1_501321110;
+	z1 *= -FIX_0_899976223;
+	z2 *= -FIX_2_562915447;
+	z3 = z3 * -FIX_1_961570560 + z5;
+	z4 = z4 * -FIX_0_390180644 + z5;
+	d[7 * step] = DESCALE(tmp4 + z1 + z3, shift);
+	d[5 * step] = DESCALE(tmp5 + z2 + z4, shift);
+	d[3 * step] = DESCALE(tmp6 + z2 + z3, shift);
+	d[step] = DESCALE(tmp7 + z1 + z4, shift);
+}
+
+static void fdct(int32_t* blk) {
+	for (int i = 0; i < 8; ++i) {
+		fdct_1d(blk + 8 * i, 1, 1);
+	}
+	for (int i = 0; i < 8; ++i) {
+		fdct_1d(blk + i, 8, 0);
+	}
+}
+
+// Bits needed for the magnitude of v
+static inline int magnitude_bits(int v) {
+	v = (v < 0) ? -v : v;
+	return (v == 0) ? 0 : 32 - __builtin_clz(v);
+}
+
+// Quantize and entropy code one block. Negative values are sent as
+// v - 1 in magnitude_bits bits, as required by the standard.
+static void encode_block(jpeg_encoder_t* enc, int32_t* blk, int comp) {
+	int table = (comp == 0) ? 0 : 1;
+	const uint16_t* recip = enc->qrecip[table];
+	fdct(blk);
+
+	int32_t dc = blk[0];
+	dc = (dc < 0) ? -(int32_t) ((-dc * recip[0] + 0x8000) >> 16)
+			: (int32_t) ((dc * recip[0] + 0x8000) >> 16);
+	int diff = dc - enc->dc_pred[comp];
+	enc->dc_pred[comp] = dc;
+	int size = magnitude_bits(diff);
+	put_bits(enc, s_dc_codes[table][size].code, s_dc_codes[table][size].size);
+	if (size > 0) {
+		put_bits(enc, (diff < 0) ? diff - 1 : diff, size);
+	}
+
+	const huff_code_t* ac = s_ac_codes[table];
+	int run = 0;
+	for (int k = 1; k < 64; ++k) {
+		int n = s_zigzag[k];
+		int32_t v = blk[n];
+		v = (v < 0) ? -(int32_t) ((-v * recip[n] + 0x8000) >> 16)
+				: (int32_t) ((v * recip[n] + 0x8000) >> 16);
+		if (v == 0) {
+			run++;
+			continue;
+		}
+		while (run > 15) {
+			put_bits(enc, ac[0xf0].code, ac[0xf0].size);
+			run -= 16;
+		}
+		size = magnitude_bits(v);
+		int sym = (run << 4) | size;
+		put_bits(enc, ac[sym].code, ac[sym].size);
+		put_bits(enc, (v < 0) ? v - 1 : v, size);
+		run = 0;
+	}
+	if (run > 0) {
+		put_bits(enc, ac[0x00].code, ac[0x00].size);
+	}
+}
+
+// Luma block at pixel x0, line y0 of the strip. step is the distance
+// between luma samples: 1 for Y8, 2 for YUYV. Pixels past the right edge
+// and lines past the end of the strip repeat the last ones.
+static void load_luma(const jpeg_encoder_t* enc, int32_t* blk,
+		const uint8_t* strip, size_t stride, size_t lines, size_t x0,
+		size_t y0, size_t step) {
+	size_t last = enc->width - 1;
+	for (size_t r = 0; r < 8; ++r) {
+		size_t y = (y0 + r < lines) ? y0 + r : lines - 1;
+		const uint8_t* row = strip + y * stride;
+		if (x0 + 7 <= last) {
+			const uint8_t* p = row + x0 * step;
+			for (size_t c = 0; c < 8; ++c) {
+				blk[r * 8 + c] = p[c * step] - 128;
+			}
+		} else {
+			for (size_t c = 0; c < 8; ++c) {
+				size_t x = (x0 + c <= last) ? x0 + c : last;
+				blk[r * 8 + c] = row[x * step] - 128;
+			}
+		}
+	}
+}
+
+// Chroma block of YUYV pixel pairs starting at pair p0; offset is 1 for
+// U, 3 for V. With 4:2:0 sampling, each block line averages two lines.
+static void load_chroma(const jpeg_encoder_t* enc, int32_t* blk,
+		const uint8_t* strip, size_t stride, size_t lines, size_t p0,
+		size_t offset) {
+	size_t last = enc->width / 2 - 1;
+	bool v2 = (enc->sampling == JPEG_ENC_YUV420);
+	for (size_t r = 0; r < 8; ++r) {
+		size_t ya = v2 ? 2 * r : r;
+		size_t yb = v2 ? ya + 1 : ya;
+		ya = (ya < lines) ? ya : lines - 1;
+		yb = (yb < lines) ? yb : lines - 1;
+		const uint8_t* a = strip + ya * stride + offset;
+		const uint8_t* b = strip + yb * stride + offset;
+		for (size_t c = 0; c < 8; ++c) {
+			size_t p = (p0 + c <= last) ? p0 + c : last;
+			blk[r * 8 + c] = ((a[4 * p] + b[4 * p] + 1) >> 1) - 128;
+		}
+	}
+}
+
+void jpeg_enc_strip(jpeg_encoder_t* enc, const uint8_t* strip, size_t stride,
+		size_t lines) {
+	int32_t blk[64];
+	if (lines == 0) {
+		return;
+	}
+	if (enc->sampling == JPEG_ENC_GRAY) {
+		for (size_t x = 0; x < enc->width; x += 8) {
+			load_luma(enc, blk, strip, stride, lines, x, 0, 1);
+			encode_block(enc, blk, 0);
+		}
+		return;
+	}
+	size_t rows = (enc->sampling == JPEG_ENC_YUV420) ? 2 : 1;
+	for (size_t x = 0; x < enc->width; x += 16) {
+		for (size_t r = 0; r < rows; ++r) {
+			load_luma(enc, blk, strip, stride, lines, x, 8 * r, 2);
+			encode_block(enc, blk, 0);
+			load_luma(enc, blk, strip, stride, lines, x + 8, 8 * r, 2);
+			encode_block(enc, blk, 0);
+		}
+		load_chroma(enc, blk, strip, stride, lines, x / 2, 1);
+		encode_block(enc, blk, 1);
+		load_chroma(enc, blk, strip, stride, lines, x / 2, 3);
+		encode_block(enc, blk, 2);
+	}
+}
+
+size_t jpeg_enc_finish(jpeg_encoder_t* enc) {
+	// pad the last byte with 1 bits
+	if (enc->bit_count > 0) {
+		put_bits(enc, 0x7f, 8 - enc->bit_count);
+	}
+	if (enc->out_len + 2 > enc->out_size) {
+		enc->overflow = true;
+	}
+	if (!enc->overflow) {
+		emit_word(enc, 0xffd9);
+	}
+	return enc->out_len;
+}
@@ -0,0 +1,80 @@
+// Copyright 2015-2016 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * Baseline JPEG encoder for sensors without a hardware encoder. Frames are
+ * fed in strips of one MCU row (8 or 16 lines), so only a strip and the
+ * output bitstream are resident. Integer DCT and Huffman coding with the
+ * standard tables; depends on nothing but this header, so jpeg_encoder.c
+ * builds for the host as well.
+ */
+
+typedef enum {
+    JPEG_ENC_GRAY,              /* Y8 input, one component, 8 line strips */
+    JPEG_ENC_YUV422,            /* YUYV input, 2x1 chroma subsampling, 8 line strips */
+    JPEG_ENC_YUV420,            /* YUYV input, 2x2 chroma subsampling, 16 line strips */
+} jpeg_enc_sampling_t;
+
+typedef struct {
+    size_t width;
+    size_t height;
+    jpeg_enc_sampling_t sampling;
+    int quality;                /* 1 (smallest) to 100 (best) */
+    uint8_t qt[2][64];          /* luma and chroma quantizers, natural order */
+    uint16_t qrecip[2][64];     /* 2^16 / (8 * qt), the DCT output is scaled by 8 */
+    int dc_pred[3];
+    uint8_t* out;
+    size_t out_size;
+    size_t out_len;
+    uint32_t bits;              /* pending output bits, msb first */
+    int bit_count;
+    bool overflow;              /* output did not fit, the image is cut short */
+} jpeg_encoder_t;
+
+/**
+ * Set up an encoder for frames of width x height pixels. quality is
+ * clamped to 1..100 and scales the standard quantization tables like the
+ * IJG encoder does.
+ */
+void jpeg_enc_init(jpeg_encoder_t* enc, size_t width, size_t height,
+        jpeg_enc_sampling_t sampling, int quality);
+
+/* Change the quality between frames, same scale as jpeg_enc_init */
+void jpeg_enc_set_quality(jpeg_encoder_t* enc, int quality);
+
+/* Lines per strip passed to jpeg_enc_strip: 8, or 16 for JPEG_ENC_YUV420 */
+size_t jpeg_enc_strip_lines(const jpeg_encoder_t* enc);
+
+/* Start a frame: write the headers to out */
+void jpeg_enc_begin(jpeg_encoder_t* enc, uint8_t* out, size_t out_size);
+
+/**
+ * Encode the next strip of the frame. stride is the distance between
+ * lines in bytes. The last strip of a frame may have fewer lines than
+ * jpeg_enc_strip_lines, its last line is repeated to fill the MCU row.
+ */
+void jpeg_enc_strip(jpeg_encoder_t* enc, const uint8_t* strip, size_t stride,
+        size_t lines);
+
+/**
+ * End the frame and return its length in bytes. If the output did not fit,
+ * overflow is set and the image lacks its end, including the EOI marker.
+ */
+size_t jpeg_enc_finish(jpeg_encoder_t* enc);
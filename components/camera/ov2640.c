@@ -493,6 +493,60 @@ static int set_pixformat(sensor_t *sensor, pixformat_t pixformat)
     /* delay n ms */
     delay(30);
 
+    if (ret == 0) {
+        sensor->framesize = framesize;
+    }
+
+    return ret;
+}
+
+static int set_window(sensor_t *sensor, int x, int y, int w, int h)
+{
+    int ret=0;
+    int out_w = resolution[sensor->framesize][0];
+    int out_h = resolution[sensor->framesize][1];
+    int in_w, in_h;
+
+    if (sensor->framesize <= FRAMESIZE_SVGA) {
+        in_w = SVGA_HSIZE;
+        in_h = SVGA_VSIZE;
+    } else {
+        in_w = UXGA_HSIZE;
+        in_h = UXGA_VSIZE;
+    }
+
+    /* DSP input window, at the scale of the current frame size */
+    uint16_t xoff = x * in_w / out_w;
+    uint16_t yoff = y * in_h / out_h;
+    uint16_t hsize = (w * in_w / out_w) & ~0x3;
+    uint16_t vsize = (h * in_h / out_h) & ~0x3;
+
+    /* Disable DSP */
+    ret |= SCCB_Write(sensor->slv_addr, BANK_SEL, BANK_SEL_DSP);
+    ret |= SCCB_Write(sensor->slv_addr, R_BYPASS, R_BYPASS_DSP_BYPAS);
+    ret |= SCCB_Write(sensor->slv_addr, RESET, RESET_DVP);
+
+    ret |= SCCB_Write(sensor->slv_addr, XOFFL, xoff&0xFF); /* OFFSET_X[7:0] */
+    ret |= SCCB_Write(sensor->slv_addr, YOFFL, yoff&0xFF); /* OFFSET_Y[7:0] */
+    ret |= SCCB_Write(sensor->slv_addr, HSIZE, (hsize>>2)&0xFF); /* H_SIZE[7:0] real/4 */
+    ret |= SCCB_Write(sensor->slv_addr, VSIZE, (vsize>>2)&0xFF); /* V_SIZE[7:0] real/4 */
+
+    /* V_SIZE[8]/OFFSET_Y[10:8]/H_SIZE[8]/OFFSET_X[10:8] */
+    ret |= SCCB_Write(sensor->slv_addr, VHYX, ((vsize>>3)&0x80) | ((yoff>>4)&0x70) |
+            ((hsize>>7)&0x08) | ((xoff>>8)&0x07));
+    ret |= SCCB_Write(sensor->slv_addr, TEST, (hsize>>4)&0x80); /* H_SIZE[9] */
+
+    /* Write output size, the window is scaled like the whole frame */
+    ret |= SCCB_Write(sensor->slv_addr, ZMOW, (w>>2)&0xFF); // OUTW[7:0] (real/4)
+    ret |= SCCB_Write(sensor->slv_addr, ZMOH, (h>>2)&0xFF); // OUTH[7:0] (real/4)
+    ret |= SCCB_Write(sensor->slv_addr, ZMHH, ((h>>8)&0x04)|((w>>10)&0x03)); // OUTH[8]/OUTW[9:8]
+
+    /* Enable DSP */
+    ret |= SCCB_Write(sensor->slv_addr, R_BYPASS, R_BYPASS_DSP_EN);
+    ret |= SCCB_Write(sensor->slv_addr, RESET, 0x00);
+    /* delay n ms */
+    delay(30);
+
     return ret;
 }
 
@@ -719,6 +773,7 @@ int ov2640_init(sensor_t *sensor)
     sensor->reset = reset;
     sensor->set_pixformat = set_pixformat;
     sensor->set_framesize = set_framesize;
+    sensor->set_window = set_window;
     sensor->set_framerate = set_framerate;
     sensor->set_contrast  = set_contrast;
     sensor->set_brightness= set_brightness;
@@ -14,6 +14,40 @@
 #include "ov7725_regs.h"
 #include <stdio.h>
 
+// Sensor windows of the COM7 resolutions, in sensor pixels. Frame sizes
+// below VGA are scaled down from the QVGA window, VGA is the VGA window 1:1.
+typedef struct {
+    uint16_t hstart;
+    uint16_t hsize;
+    uint16_t vstart;
+    uint16_t vsize;
+} sensor_window_t;
+
+static const sensor_window_t qvga_window = { 0x3F<<2, 0x50<<2, 0x03<<1, 0x78<<1 };
+static const sensor_window_t vga_window  = { 0x23<<2, 0xA0<<2, 0x07<<1, 0xF0<<1 };
+
+static const sensor_window_t *base_window(framesize_t framesize)
+{
+    return (framesize < FRAMESIZE_VGA) ? &qvga_window : &vga_window;
+}
+
+static int write_window(sensor_t *sensor, const sensor_window_t *win)
+{
+    int ret=0;
+
+    // Write MSBs
+    ret |= SCCB_Write(sensor->slv_addr, HSTART, win->hstart>>2);
+    ret |= SCCB_Write(sensor->slv_addr, HSIZE,  win->hsize>>2);
+    ret |= SCCB_Write(sensor->slv_addr, VSTART, win->vstart>>1);
+    ret |= SCCB_Write(sensor->slv_addr, VSIZE,  win->vsize>>1);
+
+    // Write LSBs
+    ret |= SCCB_Write(sensor->slv_addr, HREF, ((win->vstart&0x1) << 6) |
+            ((win->hstart&0x3) << 4) | ((win->vsize&0x1) << 2) | (win->hsize&0x3));
+
+    return ret;
+}
+
 static const uint8_t default_regs[][2] = {
     {COM3,          COM3_SWAP_YUV},
     {COM7,          COM7_RES_QVGA | COM7_FMT_YUV},
@@ -168,6 +202,13 @@ static int set_framesize(sensor_t *sensor, framesize_t framesize)
     uint16_t w = resolution[framesize][0];
     uint16_t h = resolution[framesize][1];
 
+    // VGA needs the full array, smaller sizes start from QVGA
+    uint8_t reg = SCCB_Read(sensor->slv_addr, COM7);
+    reg = (reg & ~COM7_RES_QVGA) |
+            ((framesize < FRAMESIZE_VGA) ? COM7_RES_QVGA : COM7_RES_VGA);
+    ret |= SCCB_Write(sensor->slv_addr, COM7, reg);
+    ret |= write_window(sensor, base_window(framesize));
+
     // Write MSBs
     ret |= SCCB_Write(sensor->slv_addr, HOUTSIZE, w>>2);
     ret |= SCCB_Write(sensor->slv_addr, VOUTSIZE, h>>1);
@@ -280,12 +321,40 @@ static int set_vflip(sensor_t *sensor, int enable)
     return SCCB_Write(sensor->slv_addr, COM3, reg);
 }
 
+static int set_window(sensor_t *sensor, int x, int y, int w, int h)
+{
+    int ret=0;
+    int out_w = resolution[sensor->framesize][0];
+    int out_h = resolution[sensor->framesize][1];
+    const sensor_window_t *base = base_window(sensor->framesize);
+
+    // Window in sensor pixels, at the scale of the current frame size
+    sensor_window_t win = {
+        .hstart = base->hstart + x * base->hsize / out_w,
+        .hsize  = w * base->hsize / out_w,
+        .vstart = base->vstart + y * base->vsize / out_h,
+        .vsize  = h * base->vsize / out_h,
+    };
+    ret |= write_window(sensor, &win);
+
+    // Output w x h, the window is scaled like the whole frame
+    ret |= SCCB_Write(sensor->slv_addr, HOUTSIZE, w>>2);
+    ret |= SCCB_Write(sensor->slv_addr, VOUTSIZE, h>>1);
+    ret |= SCCB_Write(sensor->slv_addr, EXHCH, ((w&0x3) | ((h&0x1) << 2)));
+
+    // Delay
+    systick_sleep(30);
+
+    return ret;
+}
+
 int ov7725_init(sensor_t *sensor)
 {
     // Set function pointers
     sensor->reset = reset;
     sensor->set_pixformat = set_pixformat;
     sensor->set_framesize = set_framesize;
+    sensor->set_window = set_window;
     sensor->set_colorbar = set_colorbar;
     sensor->set_whitebal = set_whitebal;
     sensor->set_gain_ctrl = set_gain_ctrl;
@@ -116,6 +116,7 @@ typedef struct _sensor {
     int  (*reset)               (sensor_t *sensor);
     int  (*set_pixformat)       (sensor_t *sensor, pixformat_t pixformat);
     int  (*set_framesize)       (sensor_t *sensor, framesize_t framesize);
+    int  (*set_window)          (sensor_t *sensor, int x, int y, int w, int h); // Output a window of the frame size, 1:1
     int  (*set_framerate)       (sensor_t *sensor, framerate_t framerate);
     int  (*set_contrast)        (sensor_t *sensor, int level);
     int  (*set_brightness)      (sensor_t *sensor, int level);
@@ -267,19 +267,25 @@ static void smartconfig_task(void * parm)
             //TODO Ƭ
             led_open();
             esp_err_t err = camera_run();
-            if (err != ESP_OK) {
-                ESP_LOGD(TAG, "Camera capture failed with error = %d", err);
-                return;
-            }
             led_close();
+            if (err == ESP_ERR_CAMERA_FRAME_TRUNCATED) {
+                // the start of the picture is kept, send what fitted
+                ESP_LOGW(TAG, "Picture did not fit the frame buffer, sending %d bytes",
+                        camera_get_data_size());
+                err = ESP_OK;
+            }
+            if (err == ESP_OK) {
+                pic_size = camera_get_data_size();
+                buffer = camera_get_fb();
 
-            pic_size = camera_get_data_size();
-            buffer = camera_get_fb();
-
-            ESP_LOGI(TAG, "send picture, size width = %d, height = %d", camera_get_fb_width(), camera_get_fb_height());
+                ESP_LOGI(TAG, "send picture, size width = %d, height = %d", camera_get_fb_width(), camera_get_fb_height());
 
 
-            xTaskCreate(tcp_client_task, "tcp_client", 4096, NULL, 5, NULL);
+                xTaskCreate(tcp_client_task, "tcp_client", 4096, NULL, 5, NULL);
+            } else {
+                // a task must not return, carry on with the next event
+                ESP_LOGE(TAG, "Camera capture failed with error = %d", err);
+            }
 
 
         }
@@ -0,0 +1,158 @@
+// Copyright 2015-2016 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Time every DMA filter on a VGA line of synthetic DMA buffers, then the
+// byte-wise filters of dma_filter_bytewise.c against the filters
+// dma_filter_get returns for them: filter_bytes() for grayscale and JPEG,
+// word-wide for RGB565. Reports ns per line and MB/s of DMA data read. Host
+// numbers only compare filters with each other, they say little about
+// the ESP32.
+//
+// usage: bench_dma_filter [iterations]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "dma_synth.h"
+#include "dma_filter_bytewise.h"
+
+#define BENCH_WIDTH 640
+
+static const i2s_sampling_mode_t s_modes[] = { SM_0A0B_0B0C, SM_0A0B_0C0D,
+		SM_0A00_0B00 };
+static const size_t s_hdecim[] = { 1, 2, 4 };
+
+static double now() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+typedef struct {
+	synth_line_t line;
+	uint32_t* words;            // every DMA buffer of the line, back to back
+	size_t dma_bytes;           // DMA bytes per line
+} bench_line_t;
+
+static void bench_line_init(bench_line_t* bl, i2s_sampling_mode_t mode) {
+	synth_line_init(&bl->line, mode, BENCH_WIDTH, 2);
+	size_t buf_words = bl->line.buf_bytes * synth_bytes_per_sample(mode) / 4;
+	uint8_t* data = malloc(bl->line.line_bytes);
+	uint32_t seed = 1;
+	synth_random(&seed, data, bl->line.line_bytes);
+	bl->words = malloc(buf_words * 4 * bl->line.dma_per_line);
+	bl->dma_bytes = 0;
+	for (size_t b = 0; b < bl->line.dma_per_line; ++b) {
+		synth_buf(&bl->line, data, b, bl->words + b * buf_words);
+		bl->dma_bytes += synth_buf_len(&bl->line, b);
+	}
+	free(data);
+}
+
+// Seconds taken to filter a line iterations times, each DMA buffer to
+// its own part of dst
+static double time_filter(dma_filter_t filter, const bench_line_t* bl,
+		size_t iterations, uint8_t* dst, size_t out_per_buf) {
+	size_t buf_words = bl->line.buf_bytes
+			* synth_bytes_per_sample(bl->line.mode) / 4;
+	double t0 = now();
+	for (size_t i = 0; i < iterations; ++i) {
+		for (size_t b = 0; b < bl->line.dma_per_line; ++b) {
+			filter((const dma_elem_t*) (bl->words + b * buf_words),
+					synth_buf_len(&bl->line, b), dst + b * out_per_buf);
+		}
+	}
+	return now() - t0;
+}
+
+static void report(const char* name, const bench_line_t* bl, double seconds,
+		size_t lines) {
+	double ns = seconds * 1e9 / lines;
+	printf("%-40s %9.1f ns/line %9.1f MB/s\n", name, ns,
+			bl->dma_bytes * lines / seconds / 1e6);
+}
+
+int main(int argc, char** argv) {
+	size_t iterations = (argc > 1) ? strtoul(argv[1], NULL, 0) : 20000;
+	uint8_t* dst = malloc(BENCH_WIDTH * 3 + 4);
+	printf("%zu lines of %d pixels per filter\n", iterations, BENCH_WIDTH);
+
+	for (size_t m = 0; m < sizeof(s_modes) / sizeof(s_modes[0]); ++m) {
+		bench_line_t bl;
+		bench_line_init(&bl, s_modes[m]);
+		size_t buf_words = bl.line.buf_bytes
+				* synth_bytes_per_sample(s_modes[m]) / 4;
+		for (int layout = DMA_FILTER_Y8; layout <= DMA_FILTER_RGB565_LE;
+				++layout) {
+			for (size_t d = 0; d < sizeof(s_hdecim) / sizeof(s_hdecim[0]);
+					++d) {
+				for (int box = 0; box < 2; ++box) {
+					dma_filter_t filter = dma_filter_get(s_modes[m], layout,
+							s_hdecim[d], box);
+					if (filter == NULL) {
+						continue;
+					}
+					size_t out = bl.line.buf_bytes / 2 / s_hdecim[d] * 3;
+					double t = time_filter(filter, &bl, iterations, dst, out);
+					char name[64];
+					snprintf(name, sizeof(name), "%s %s /%zu%s",
+							synth_mode_name(s_modes[m]),
+							synth_layout_name(layout), s_hdecim[d],
+							box ? " box" : "");
+					report(name, &bl, t, iterations);
+				}
+			}
+		}
+		dma_filter_planar_t planar = dma_filter_planar_get(s_modes[m]);
+		if (planar != NULL) {
+			size_t pixels = bl.line.buf_bytes / 2;
+			double t0 = now();
+			for (size_t i = 0; i < iterations; ++i) {
+				for (size_t b = 0; b < bl.line.dma_per_line; ++b) {
+					planar((const dma_elem_t*) (bl.words + b * buf_words),
+							synth_buf_len(&bl.line, b), dst + b * pixels,
+							dst + BENCH_WIDTH + b * pixels / 2,
+							dst + BENCH_WIDTH * 2 + b * pixels / 2);
+				}
+			}
+			char name[64];
+			snprintf(name, sizeof(name), "%s planar",
+					synth_mode_name(s_modes[m]));
+			report(name, &bl, now() - t0, iterations);
+		}
+		free(bl.words);
+	}
+
+	printf("\nbyte-wise filters against the ones replacing them\n");
+	for (size_t i = 0; i < bytewise_filter_count; ++i) {
+		const bytewise_filter_t* old = &bytewise_filters[i];
+		dma_filter_t filter = dma_filter_get(old->mode, old->layout, 1, false);
+		bench_line_t bl;
+		bench_line_init(&bl, old->mode);
+		size_t out = bl.line.buf_bytes * 3 / 2;
+		double t_old = time_filter(old->filter, &bl, iterations, dst, out);
+		double t_new = time_filter(filter, &bl, iterations, dst, out);
+		char name[64];
+		snprintf(name, sizeof(name), "%s %s byte-wise", old->name,
+				synth_mode_name(old->mode));
+		report(name, &bl, t_old, iterations);
+		snprintf(name, sizeof(name), "%s %s current", old->name,
+				synth_mode_name(old->mode));
+		report(name, &bl, t_new, iterations);
+		printf("%-40s %9.2fx\n", "speedup", t_old / t_new);
+		free(bl.words);
+	}
+	free(dst);
+	return 0;
+}
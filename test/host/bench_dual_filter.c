@@ -0,0 +1,213 @@
+// Copyright 2015-2016 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Per-line filter time with CONFIG_CAMERA_DUAL_CORE_FILTER off and on.
+// Frames are filtered from a ring of DMA buffers into a frame buffer, as
+// dma_filter_task does. In dual mode the odd lines go through an SPSC
+// work ring to a second thread, like dma_filter_aux_task, and each frame
+// ends with a flush of that thread. Threads are pinned to two cores when
+// the host allows it. The frame is also checked against single-core
+// output, so a race in the split shows up as a failure.
+//
+// usage: bench_dual_filter [frames]
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include "dma_synth.h"
+
+#define BENCH_WIDTH     640
+#define BENCH_HEIGHT    480
+#define RING_LINES      16
+#define WORK_RING       64      // power of 2
+#define FRAME_END       SIZE_MAX
+
+typedef struct {
+	const char* name;
+	i2s_sampling_mode_t mode;
+	dma_filter_layout_t layout;
+	size_t fb_bytes_per_pixel;
+} bench_format_t;
+
+static const bench_format_t s_formats[] = {
+	{ "grayscale", SM_0A0B_0C0D, DMA_FILTER_Y8, 1 },
+	{ "grayscale high speed", SM_0A0B_0B0C, DMA_FILTER_Y8, 1 },
+	{ "RGB565 to RGB888", SM_0A00_0B00, DMA_FILTER_RGB888, 3 },
+	{ "RGB565 high speed", SM_0A0B_0B0C, DMA_FILTER_RGB565_LE, 2 },
+	{ "RGB565 packed to BGR888", SM_0A0B_0C0D, DMA_FILTER_BGR888, 3 },
+};
+
+typedef struct {
+	size_t buf_idx;
+	uint8_t* dst;
+} work_t;
+
+typedef struct {
+	dma_filter_t filter;
+	synth_line_t line;
+	uint32_t* ring;             // RING_LINES lines of DMA buffers
+	size_t buf_words;
+	uint8_t* fb;
+	size_t fb_line;             // frame buffer bytes per line
+	size_t fb_buf;              // frame buffer bytes per DMA buffer
+	work_t work[WORK_RING];
+	atomic_size_t work_wr;
+	atomic_size_t work_rd;
+	atomic_bool frame_done;
+	atomic_bool quit;
+} bench_t;
+
+static double now() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void pin(int cpu) {
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+static void run(bench_t* b, size_t buf_idx, uint8_t* dst) {
+	b->filter((const dma_elem_t*) (b->ring + buf_idx * b->buf_words),
+			synth_buf_len(&b->line, buf_idx % b->line.dma_per_line), dst);
+}
+
+static bool aux_push(bench_t* b, size_t buf_idx, uint8_t* dst) {
+	size_t wr = atomic_load_explicit(&b->work_wr, memory_order_relaxed);
+	if (wr - atomic_load_explicit(&b->work_rd, memory_order_acquire)
+			>= WORK_RING) {
+		return false;
+	}
+	b->work[wr & (WORK_RING - 1)] = (work_t) { buf_idx, dst };
+	atomic_store_explicit(&b->work_wr, wr + 1, memory_order_release);
+	return true;
+}
+
+static void* aux_thread(void* arg) {
+	bench_t* b = (bench_t*) arg;
+	pin(1);
+	while (!atomic_load_explicit(&b->quit, memory_order_relaxed)) {
+		size_t rd = atomic_load_explicit(&b->work_rd, memory_order_relaxed);
+		if (rd == atomic_load_explicit(&b->work_wr, memory_order_acquire)) {
+			sched_yield();
+			continue;
+		}
+		work_t w = b->work[rd & (WORK_RING - 1)];
+		atomic_store_explicit(&b->work_rd, rd + 1, memory_order_release);
+		if (w.buf_idx == FRAME_END) {
+			atomic_store_explicit(&b->frame_done, true, memory_order_release);
+			continue;
+		}
+		run(b, w.buf_idx, w.dst);
+	}
+	return NULL;
+}
+
+static void filter_frame(bench_t* b, bool dual) {
+	for (size_t y = 0; y < BENCH_HEIGHT; ++y) {
+		size_t first = (y % RING_LINES) * b->line.dma_per_line;
+		for (size_t i = 0; i < b->line.dma_per_line; ++i) {
+			uint8_t* dst = b->fb + y * b->fb_line + i * b->fb_buf;
+			if (dual && (y & 1) && aux_push(b, first + i, dst)) {
+				continue;
+			}
+			run(b, first + i, dst);
+		}
+	}
+	if (dual) {
+		atomic_store_explicit(&b->frame_done, false, memory_order_relaxed);
+		while (!aux_push(b, FRAME_END, NULL)) {
+			sched_yield();
+		}
+		while (!atomic_load_explicit(&b->frame_done, memory_order_acquire)) {
+			sched_yield();
+		}
+	}
+}
+
+static int bench_format(const bench_format_t* fmt, size_t frames) {
+	bench_t b = { 0 };
+	b.filter = dma_filter_get(fmt->mode, fmt->layout, 1, false);
+	if (b.filter == NULL) {
+		return 0;
+	}
+	synth_line_init(&b.line, fmt->mode, BENCH_WIDTH, 2);
+	b.buf_words = b.line.buf_bytes * synth_bytes_per_sample(fmt->mode) / 4;
+	b.ring = malloc(RING_LINES * b.line.dma_per_line * b.buf_words * 4);
+	uint8_t* data = malloc(b.line.line_bytes);
+	uint32_t seed = 1;
+	for (size_t y = 0; y < RING_LINES; ++y) {
+		synth_random(&seed, data, b.line.line_bytes);
+		for (size_t i = 0; i < b.line.dma_per_line; ++i) {
+			synth_buf(&b.line, data, i,
+					b.ring + (y * b.line.dma_per_line + i) * b.buf_words);
+		}
+	}
+	free(data);
+	b.fb_line = BENCH_WIDTH * fmt->fb_bytes_per_pixel;
+	b.fb_buf = b.fb_line / b.line.dma_per_line;
+	size_t fb_size = b.fb_line * BENCH_HEIGHT;
+	b.fb = malloc(fb_size);
+	uint8_t* single = malloc(fb_size);
+
+	pthread_t aux;
+	pthread_create(&aux, NULL, &aux_thread, &b);
+	double t[2];
+	for (int dual = 0; dual < 2; ++dual) {
+		filter_frame(&b, dual);     // warm up
+		double t0 = now();
+		for (size_t f = 0; f < frames; ++f) {
+			filter_frame(&b, dual);
+		}
+		t[dual] = now() - t0;
+		if (!dual) {
+			memcpy(single, b.fb, fb_size);
+			memset(b.fb, 0, fb_size);
+		}
+	}
+	atomic_store(&b.quit, true);
+	pthread_join(aux, NULL);
+
+	int failed = memcmp(single, b.fb, fb_size) != 0;
+	size_t lines = frames * BENCH_HEIGHT;
+	printf("%-26s %8.1f ns/line one core %8.1f ns/line two cores %6.2fx%s\n",
+			fmt->name, t[0] * 1e9 / lines, t[1] * 1e9 / lines, t[0] / t[1],
+			failed ? "  FAIL: output differs" : "");
+	free(b.ring);
+	free(b.fb);
+	free(single);
+	return failed;
+}
+
+int main(int argc, char** argv) {
+	size_t frames = (argc > 1) ? strtoul(argv[1], NULL, 0) : 200;
+	pin(0);
+	printf("%zu frames of %dx%d\n", frames, BENCH_WIDTH, BENCH_HEIGHT);
+	if (sysconf(_SC_NPROCESSORS_ONLN) < 2) {
+		printf("only one CPU online, two core numbers show the overhead only\n");
+	}
+	int failures = 0;
+	for (size_t i = 0; i < sizeof(s_formats) / sizeof(s_formats[0]); ++i) {
+		failures += bench_format(&s_formats[i], frames);
+	}
+	return failures != 0;
+}
@@ -0,0 +1,68 @@
+// Copyright 2015-2016 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Software JPEG encoder time per frame against libjpeg at the same
+// sampling and quality, VGA frames fed in strips as camera.c does.
+//
+// usage: bench_jpeg_encoder [frames]
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "jpeg_ref.h"
+
+#define WIDTH   640
+#define HEIGHT  480
+
+static double now() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+int main(int argc, char** argv) {
+	size_t frames = (argc > 1) ? strtoul(argv[1], NULL, 0) : 20;
+	static const char* names[] = { "gray", "YUV422", "YUV420" };
+	ref_image_t img;
+	ref_image_init(&img, WIDTH, HEIGHT);
+	size_t out_size = WIDTH * HEIGHT * 3;
+	uint8_t* out = malloc(out_size);
+	printf("%zu frames of %dx%d\n", frames, WIDTH, HEIGHT);
+	for (int s = JPEG_ENC_GRAY; s <= JPEG_ENC_YUV420; ++s) {
+		jpeg_enc_sampling_t sampling = (jpeg_enc_sampling_t) s;
+		for (int q = 10; q <= 100; q += 30) {
+			jpeg_encoder_t enc;
+			jpeg_enc_init(&enc, WIDTH, HEIGHT, sampling, q);
+			size_t len = 0;
+			double t0 = now();
+			for (size_t f = 0; f < frames; ++f) {
+				len = ref_encode_strips(&enc, &img, out, out_size);
+			}
+			double t = (now() - t0) / frames;
+			size_t ref_len = 0;
+			t0 = now();
+			for (size_t f = 0; f < frames; ++f) {
+				uint8_t* ref = NULL;
+				ref_len = ref_encode(&img, sampling, q, &ref);
+				free(ref);
+			}
+			double t_ref = (now() - t0) / frames;
+			printf("%-6s q %3d: %6zu bytes %7.2f ms/frame %6.1f Mpixel/s, "
+					"libjpeg %6zu bytes %7.2f ms/frame\n", names[s], q, len,
+					t * 1e3, WIDTH * HEIGHT / t / 1e6, ref_len, t_ref * 1e3);
+		}
+	}
+	ref_image_free(&img);
+	free(out);
+	return 0;
+}
@@ -0,0 +1,104 @@
+// Copyright 2015-2016 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "dma_filter_bytewise.h"
+
+static void dma_filter_grayscale(const dma_elem_t* src, size_t len,
+		uint8_t* dst) {
+	size_t end = len / sizeof(dma_elem_t) / 4;
+	for (size_t i = 0; i < end; ++i) {
+		// manually unrolling 4 iterations of the loop here
+		dst[0] = src[0].sample1;
+		dst[1] = src[1].sample1;
+		dst[2] = src[2].sample1;
+		dst[3] = src[3].sample1;
+		src += 4;
+		dst += 4;
+	}
+}
+
+static void dma_filter_grayscale_highspeed(const dma_elem_t* src, size_t len,
+		uint8_t* dst) {
+	size_t end = len / sizeof(dma_elem_t) / 8;
+	for (size_t i = 0; i < end; ++i) {
+		// manually unrolling 4 iterations of the loop here
+		dst[0] = src[0].sample1;
+		dst[1] = src[2].sample1;
+		dst[2] = src[4].sample1;
+		dst[3] = src[6].sample1;
+		src += 8;
+		dst += 4;
+	}
+	// the final sample of a line in SM_0A0B_0B0C sampling mode needs special handling
+	if ((len & 0x7) != 0) {
+		dst[0] = src[0].sample1;
+		dst[1] = src[2].sample1;
+	}
+}
+
+static void dma_filter_jpeg(const dma_elem_t* src, size_t len, uint8_t* dst) {
+	size_t end = len / sizeof(dma_elem_t) / 4;
+	// manually unrolling 4 iterations of the loop here
+	for (size_t i = 0; i < end; ++i) {
+		dst[0] = src[0].sample1;
+		dst[1] = src[1].sample1;
+		dst[2] = src[2].sample1;
+		dst[3] = src[3].sample1;
+		src += 4;
+		dst += 4;
+	}
+	// the final sample of a line in SM_0A0B_0B0C sampling mode needs special handling
+	if ((len & 0x7) != 0) {
+		dst[0] = src[0].sample1;
+		dst[1] = src[1].sample1;
+		dst[2] = src[2].sample1;
+		dst[3] = src[2].sample2;
+	}
+}
+
+static inline void rgb565_to_888(uint8_t in1, uint8_t in2, uint8_t* dst) {
+	dst[0] = (in2 & 0b00011111) << 3; // blue
+	dst[1] = ((in1 & 0b111) << 5) | ((in2 & 0b11100000) >> 3); // green
+	dst[2] = in1 & 0b11111000; // red
+}
+
+static void dma_filter_rgb565(const dma_elem_t* src, size_t len,
+		uint8_t* dst) {
+	const int unroll = 2;         // manually unrolling 2 iterations of the loop
+	const int samples_per_pixel = 2;
+	const int bytes_per_pixel = 3;
+	size_t end = len / sizeof(dma_elem_t) / unroll / samples_per_pixel;
+	for (size_t i = 0; i < end; ++i) {
+		rgb565_to_888(src[0].sample1, src[1].sample1, &dst[0]);
+		rgb565_to_888(src[2].sample1, src[3].sample1, &dst[3]);
+		dst += bytes_per_pixel * unroll;
+		src += samples_per_pixel * unroll;
+	}
+	if ((len & 0x7) != 0) {
+		rgb565_to_888(src[0].sample1, src[1].sample1, &dst[0]);
+		rgb565_to_888(src[2].sample1, src[2].sample2, &dst[3]);
+	}
+}
+
+const bytewise_filter_t bytewise_filters[] = {
+	{ "grayscale", SM_0A0B_0C0D, DMA_FILTER_Y8, &dma_filter_grayscale },
+	{ "grayscale_highspeed", SM_0A0B_0B0C, DMA_FILTER_Y8,
+			&dma_filter_grayscale_highspeed },
+	{ "jpeg", SM_0A0B_0B0C, DMA_FILTER_RAW, &dma_filter_jpeg },
+	{ "jpeg", SM_0A00_0B00, DMA_FILTER_RAW, &dma_filter_jpeg },
+	{ "rgb565", SM_0A0B_0B0C, DMA_FILTER_BGR888, &dma_filter_rgb565 },
+	{ "rgb565", SM_0A00_0B00, DMA_FILTER_BGR888, &dma_filter_rgb565 },
+};
+
+const size_t bytewise_filter_count = sizeof(bytewise_filters)
+		/ sizeof(bytewise_filters[0]);
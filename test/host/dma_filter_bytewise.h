@@ -0,0 +1,33 @@
+// Copyright 2015-2016 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "dma_filter.h"
+
+/**
+ * The byte-wise filters camera.c had before dma_filter.c, kept to check
+ * and time the dma_filter.c filters against them. They take the DMA buffer
+ * length instead of an lldesc_t, otherwise the loops are unchanged,
+ * except for the green channel fix in the RGB565 conversion.
+ */
+typedef struct {
+    const char* name;
+    i2s_sampling_mode_t mode;
+    dma_filter_layout_t layout;
+    dma_filter_t filter;
+} bytewise_filter_t;
+
+extern const bytewise_filter_t bytewise_filters[];
+extern const size_t bytewise_filter_count;
@@ -0,0 +1,196 @@
+// Copyright 2015-2016 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <string.h>
+#include "dma_synth.h"
+
+const int synth_resolution[][2] = { { 40, 30 }, /* 40x30 */
+{ 64, 32 }, /* 64x32 */
+{ 64, 64 }, /* 64x64 */
+{ 88, 72 }, /* QQCIF */
+{ 160, 120 }, /* QQVGA */
+{ 128, 160 }, /* QQVGA2*/
+{ 176, 144 }, /* QCIF  */
+{ 240, 160 }, /* HQVGA */
+{ 320, 240 }, /* QVGA  */
+{ 352, 288 }, /* CIF   */
+{ 640, 480 }, /* VGA   */
+{ 800, 600 }, /* SVGA  */
+{ 1280, 1024 }, /* SXGA  */
+{ 1600, 1200 }, /* UXGA  */
+};
+
+const size_t synth_resolution_count = sizeof(synth_resolution)
+		/ sizeof(synth_resolution[0]);
+
+size_t synth_bytes_per_sample(i2s_sampling_mode_t mode) {
+	return (mode == SM_0A0B_0C0D) ? 2 : 4;
+}
+
+void synth_line_init(synth_line_t* line, i2s_sampling_mode_t mode,
+		size_t width, size_t bytes_per_pixel) {
+	size_t size = width * bytes_per_pixel * synth_bytes_per_sample(mode);
+	line->mode = mode;
+	line->line_bytes = width * bytes_per_pixel;
+	line->dma_per_line = 1;
+	while (size > SYNTH_DMA_BUF_MAX) {
+		size /= 2;
+		line->dma_per_line *= 2;
+	}
+	line->buf_bytes = line->line_bytes / line->dma_per_line;
+}
+
+size_t synth_buf_len(const synth_line_t* line, size_t b) {
+	size_t len = line->buf_bytes * synth_bytes_per_sample(line->mode);
+	// in SM_0A0B_0B0C the last buffer of a line is one word short
+	if (line->mode == SM_0A0B_0B0C && b == line->dma_per_line - 1) {
+		len -= 4;
+	}
+	return len;
+}
+
+static uint32_t noise(uint32_t* state) {
+	*state = *state * 1103515245 + 12345;
+	return *state >> 8;
+}
+
+// DMA word from its two samples, unused bytes are noise. The FIFO writes
+// 00 s1 00 s2 (most significant byte first), see dma_elem_t.
+static uint32_t word(uint32_t* state, uint8_t s1, uint8_t s2) {
+	uint32_t n = noise(state);
+	return ((n & 0xff) << 24) | (s1 << 16) | ((n & 0xff00)) | s2;
+}
+
+void synth_buf(const synth_line_t* line, const uint8_t* data, size_t b,
+		uint32_t* words) {
+	const uint8_t* s = data + b * line->buf_bytes;
+	size_t n = line->buf_bytes;
+	uint32_t state = (uint32_t) (b * 7919 + n);
+	switch (line->mode) {
+	case SM_0A0B_0B0C:
+		// every byte takes a word, sample2 is the byte after it. The byte
+		// after the last one of a buffer is sent again at the start of the
+		// next buffer, or is not there at the end of a line.
+		for (size_t i = 0; i < n; ++i) {
+			uint8_t next = (b * n + i + 1 < line->line_bytes) ? s[i + 1]
+					: noise(&state);
+			words[i] = word(&state, s[i], next);
+		}
+		break;
+	case SM_0A0B_0C0D:
+		for (size_t i = 0; i < n / 2; ++i) {
+			words[i] = word(&state, s[2 * i], s[2 * i + 1]);
+		}
+		break;
+	case SM_0A00_0B00:
+		for (size_t i = 0; i < n; ++i) {
+			words[i] = word(&state, s[i], noise(&state));
+		}
+		break;
+	}
+}
+
+void synth_random(uint32_t* state, uint8_t* dst, size_t len) {
+	for (size_t i = 0; i < len; ++i) {
+		dst[i] = noise(state);
+	}
+}
+
+static void ref_rgb565(uint8_t hi, uint8_t lo, uint8_t* r, uint8_t* g,
+		uint8_t* b) {
+	uint16_t p = (hi << 8) | lo;
+	*r = ((p >> 11) & 0x1f) << 3;
+	*g = ((p >> 5) & 0x3f) << 2;
+	*b = (p & 0x1f) << 3;
+}
+
+size_t ref_filter(const uint8_t* in, size_t n, dma_filter_layout_t layout,
+		size_t hdecim, bool box, uint8_t* out) {
+	uint8_t* start = out;
+	if (layout == DMA_FILTER_RAW) {
+		for (size_t i = 0; i < n; i += hdecim) {
+			*out++ = in[i];
+		}
+		return out - start;
+	}
+	// every other layout takes two camera bytes per pixel
+	for (size_t p = 0; (p + 1) * hdecim * 2 <= n; ++p) {
+		const uint8_t* px = in + p * hdecim * 2;
+		uint8_t r, g, b;
+		switch (layout) {
+		case DMA_FILTER_Y8:
+			if (box) {
+				unsigned sum = 0;
+				for (size_t k = 0; k < hdecim; ++k) {
+					sum += px[2 * k];
+				}
+				*out++ = (sum + hdecim / 2) / hdecim;
+			} else {
+				*out++ = px[0];
+			}
+			break;
+		case DMA_FILTER_RGB565_BE:
+			*out++ = px[0];
+			*out++ = px[1];
+			break;
+		case DMA_FILTER_RGB565_LE:
+			*out++ = px[1];
+			*out++ = px[0];
+			break;
+		case DMA_FILTER_BGR888:
+			ref_rgb565(px[0], px[1], &r, &g, &b);
+			*out++ = b;
+			*out++ = g;
+			*out++ = r;
+			break;
+		case DMA_FILTER_RGB888:
+			ref_rgb565(px[0], px[1], &r, &g, &b);
+			*out++ = r;
+			*out++ = g;
+			*out++ = b;
+			break;
+		default:
+			break;
+		}
+	}
+	return out - start;
+}
+
+size_t ref_filter_planar(const uint8_t* in, size_t n, uint8_t* y, uint8_t* u,
+		uint8_t* v) {
+	for (size_t p = 0; p < n / 4; ++p) {
+		y[2 * p] = in[4 * p];
+		u[p] = in[4 * p + 1];
+		y[2 * p + 1] = in[4 * p + 2];
+		v[p] = in[4 * p + 3];
+	}
+	return n / 4 * 2;
+}
+
+const char* synth_mode_name(i2s_sampling_mode_t mode) {
+	switch (mode) {
+	case SM_0A0B_0B0C:
+		return "0A0B_0B0C";
+	case SM_0A0B_0C0D:
+		return "0A0B_0C0D";
+	case SM_0A00_0B00:
+		return "0A00_0B00";
+	}
+	return "?";
+}
+
+const char* synth_layout_name(dma_filter_layout_t layout) {
+	static const char* names[] = { "Y8", "RAW", "BGR888", "RGB888",
+			"RGB565_BE", "RGB565_LE" };
+	return (layout <= DMA_FILTER_RGB565_LE) ? names[layout] : "?";
+}
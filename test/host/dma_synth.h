@@ -0,0 +1,79 @@
+// Copyright 2015-2016 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "dma_filter.h"
+
+/**
+ * Synthetic DMA buffers for host tests and benchmarks. A line of camera
+ * bytes is split into DMA buffers the way dma_geometry() in camera.c does
+ * it, and each buffer is filled with the words the I2S FIFO would write
+ * for the sampling mode. Bytes the FIFO leaves unused are set to noise,
+ * so filters which read them show up as mismatches.
+ *
+ * The reference filters below work on plain camera bytes and share no
+ * code with dma_filter.c.
+ */
+
+#define SYNTH_DMA_BUF_MAX   4095    /* same as DMA_BUF_MAX in camera.c */
+
+/* Frame sizes of camera_framesize_t, as in resolution[] of camera.c */
+extern const int synth_resolution[][2];
+extern const size_t synth_resolution_count;
+
+typedef struct {
+    i2s_sampling_mode_t mode;
+    size_t line_bytes;          /* camera bytes per line */
+    size_t dma_per_line;        /* DMA buffers per line */
+    size_t buf_bytes;           /* camera bytes per DMA buffer */
+} synth_line_t;
+
+/* Bytes of DMA data per camera byte in the given sampling mode */
+size_t synth_bytes_per_sample(i2s_sampling_mode_t mode);
+
+/* Split a line of width pixels of bytes_per_pixel camera bytes */
+void synth_line_init(synth_line_t* line, i2s_sampling_mode_t mode,
+        size_t width, size_t bytes_per_pixel);
+
+/* lldesc_t length of DMA buffer b of the line */
+size_t synth_buf_len(const synth_line_t* line, size_t b);
+
+/**
+ * Fill words with DMA buffer b of a line whose camera bytes are in data.
+ * words must hold buf_bytes * synth_bytes_per_sample(mode) bytes.
+ */
+void synth_buf(const synth_line_t* line, const uint8_t* data, size_t b,
+        uint32_t* words);
+
+/* Deterministic pseudo random bytes, seeded by *state */
+void synth_random(uint32_t* state, uint8_t* dst, size_t len);
+
+/**
+ * Frame buffer bytes for n camera bytes in the given layout, decimated
+ * by hdecim, with box averaging if box is set. Returns the bytes written.
+ */
+size_t ref_filter(const uint8_t* in, size_t n, dma_filter_layout_t layout,
+        size_t hdecim, bool box, uint8_t* out);
+
+/* YUYV to planes, returns the number of pixels written to y */
+size_t ref_filter_planar(const uint8_t* in, size_t n, uint8_t* y, uint8_t* u,
+        uint8_t* v);
+
+/* Names for test and benchmark output */
+const char* synth_mode_name(i2s_sampling_mode_t mode);
+const char* synth_layout_name(dma_filter_layout_t layout);
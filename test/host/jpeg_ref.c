@@ -0,0 +1,152 @@
+// Copyright 2015-2016 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <jpeglib.h>
+#include "jpeg_ref.h"
+
+static uint8_t clamp(double v) {
+	return (v < 0) ? 0 : (v > 255) ? 255 : (uint8_t) v;
+}
+
+void ref_image_init(ref_image_t* img, size_t width, size_t height) {
+	img->width = width;
+	img->height = height;
+	img->y = malloc(width * height);
+	img->yuyv = malloc(width * height * 2);
+	img->ycc = malloc(width * height * 3);
+	uint32_t seed = 1;
+	for (size_t y = 0; y < height; ++y) {
+		for (size_t x = 0; x < width; ++x) {
+			seed = seed * 1103515245 + 12345;
+			double v = 128 + 60 * sin(x * 0.05) * cos(y * 0.03)
+					+ ((x / 40) % 2 ? 30 : -30) + (int) ((seed >> 16) % 11) - 5;
+			img->y[y * width + x] = clamp(v);
+		}
+		for (size_t x = 0; x < width; x += 2) {
+			uint8_t u = clamp(128 + 50 * sin(x * 0.01 + y * 0.02));
+			uint8_t v = clamp(128 + 40 * cos(x * 0.02));
+			uint8_t* p = img->yuyv + (y * width + x) * 2;
+			p[0] = img->y[y * width + x];
+			p[1] = u;
+			p[2] = img->y[y * width + x + 1];
+			p[3] = v;
+			for (size_t k = 0; k < 2; ++k) {
+				uint8_t* q = img->ycc + (y * width + x + k) * 3;
+				q[0] = img->y[y * width + x + k];
+				q[1] = u;
+				q[2] = v;
+			}
+		}
+	}
+}
+
+void ref_image_free(ref_image_t* img) {
+	free(img->y);
+	free(img->yuyv);
+	free(img->ycc);
+}
+
+size_t ref_encode_strips(jpeg_encoder_t* enc, const ref_image_t* img,
+		uint8_t* out, size_t out_size) {
+	bool gray = (enc->sampling == JPEG_ENC_GRAY);
+	const uint8_t* src = gray ? img->y : img->yuyv;
+	size_t stride = img->width * (gray ? 1 : 2);
+	size_t strip = jpeg_enc_strip_lines(enc);
+	jpeg_enc_begin(enc, out, out_size);
+	for (size_t y = 0; y < enc->height; y += strip) {
+		size_t lines = (enc->height - y < strip) ? enc->height - y : strip;
+		jpeg_enc_strip(enc, src + y * stride, stride, lines);
+	}
+	return jpeg_enc_finish(enc);
+}
+
+int ref_decode(const uint8_t* jpg, size_t len, uint8_t* out, size_t* width,
+		size_t* height, int* comps) {
+	struct jpeg_decompress_struct c;
+	struct jpeg_error_mgr e;
+	c.err = jpeg_std_error(&e);
+	jpeg_create_decompress(&c);
+	jpeg_mem_src(&c, (unsigned char*) jpg, len);
+	if (jpeg_read_header(&c, TRUE) != JPEG_HEADER_OK) {
+		jpeg_destroy_decompress(&c);
+		return -1;
+	}
+	if (c.num_components == 3) {
+		c.out_color_space = JCS_YCbCr;
+	}
+	jpeg_start_decompress(&c);
+	*width = c.output_width;
+	*height = c.output_height;
+	*comps = c.output_components;
+	while (c.output_scanline < c.output_height) {
+		uint8_t* row = out + c.output_scanline * *width * *comps;
+		jpeg_read_scanlines(&c, &row, 1);
+	}
+	jpeg_finish_decompress(&c);
+	int warnings = e.num_warnings;
+	jpeg_destroy_decompress(&c);
+	return warnings;
+}
+
+size_t ref_encode(const ref_image_t* img, jpeg_enc_sampling_t sampling,
+		int quality, uint8_t** out) {
+	struct jpeg_compress_struct c;
+	struct jpeg_error_mgr e;
+	unsigned long size = 0;
+	bool gray = (sampling == JPEG_ENC_GRAY);
+	const uint8_t* src = gray ? img->y : img->ycc;
+	size_t stride = img->width * (gray ? 1 : 3);
+	*out = NULL;
+	c.err = jpeg_std_error(&e);
+	jpeg_create_compress(&c);
+	jpeg_mem_dest(&c, out, &size);
+	c.image_width = img->width;
+	c.image_height = img->height;
+	c.input_components = gray ? 1 : 3;
+	c.in_color_space = gray ? JCS_GRAYSCALE : JCS_YCbCr;
+	jpeg_set_defaults(&c);
+	jpeg_set_quality(&c, quality, TRUE);
+	if (!gray) {
+		c.comp_info[0].h_samp_factor = 2;
+		c.comp_info[0].v_samp_factor =
+				(sampling == JPEG_ENC_YUV420) ? 2 : 1;
+	}
+	jpeg_start_compress(&c, TRUE);
+	while (c.next_scanline < c.image_height) {
+		uint8_t* row = (uint8_t*) src + c.next_scanline * stride;
+		jpeg_write_scanlines(&c, &row, 1);
+	}
+	jpeg_finish_compress(&c);
+	jpeg_destroy_compress(&c);
+	return size;
+}
+
+double ref_psnr(const ref_image_t* img, jpeg_enc_sampling_t sampling,
+		const uint8_t* decoded, int comps) {
+	bool gray = (sampling == JPEG_ENC_GRAY);
+	int compared = (sampling == JPEG_ENC_YUV422) ? 3 : 1;
+	size_t pixels = img->width * img->height;
+	double se = 0;
+	for (size_t i = 0; i < pixels; ++i) {
+		for (int k = 0; k < compared; ++k) {
+			int ref = gray ? img->y[i] : img->ycc[i * 3 + k];
+			double d = decoded[i * comps + k] - ref;
+			se += d * d;
+		}
+	}
+	return 10 * log10(255.0 * 255.0 * pixels * compared / se);
+}
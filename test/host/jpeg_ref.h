@@ -0,0 +1,68 @@
+// Copyright 2015-2016 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "jpeg_encoder.h"
+
+/**
+ * Test images and libjpeg as a reference for the software JPEG encoder.
+ * libjpeg decodes what jpeg_encoder.c writes, and encodes the same image
+ * at the same quality to compare size and PSNR against.
+ */
+
+typedef struct {
+    size_t width;
+    size_t height;
+    uint8_t* y;                 /* Y8, width x height */
+    uint8_t* yuyv;              /* YUYV, as the sensor sends it */
+    uint8_t* ycc;               /* YCbCr, 3 bytes per pixel, chroma per pair */
+} ref_image_t;
+
+/* Smooth gradients, hard edges and some noise; width has to be even */
+void ref_image_init(ref_image_t* img, size_t width, size_t height);
+
+void ref_image_free(ref_image_t* img);
+
+/**
+ * Feed a frame to the encoder in strips, as camera.c does, and return the
+ * JPEG size. The encoder has to be set up for the image size.
+ */
+size_t ref_encode_strips(jpeg_encoder_t* enc, const ref_image_t* img,
+        uint8_t* out, size_t out_size);
+
+/**
+ * Decode with libjpeg into out, one byte per component, YCbCr left
+ * unconverted. Returns the number of libjpeg warnings, -1 if the header
+ * could not be read. The decoded size and component count are returned
+ * through width, height and comps.
+ */
+int ref_decode(const uint8_t* jpg, size_t len, uint8_t* out, size_t* width,
+        size_t* height, int* comps);
+
+/**
+ * Encode the image with libjpeg in the same sampling and quality.
+ * Returns the size, *out is allocated by libjpeg and freed with free().
+ */
+size_t ref_encode(const ref_image_t* img, jpeg_enc_sampling_t sampling,
+        int quality, uint8_t** out);
+
+/**
+ * PSNR of a decoded image against the source, in dB. Only luma is compared
+ * for JPEG_ENC_YUV420, where the chroma of odd lines is not in the source.
+ */
+double ref_psnr(const ref_image_t* img, jpeg_enc_sampling_t sampling,
+        const uint8_t* decoded, int comps);
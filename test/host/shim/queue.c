@@ -0,0 +1,129 @@
+// Copyright 2015-2016 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include <stdbool.h>
+#include "freertos/queue.h"
+
+struct host_queue {
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	uint8_t* items;
+	size_t item_size;
+	size_t length;
+	size_t head;
+	size_t count;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+	QueueHandle_t q = calloc(1, sizeof(*q));
+	if (q == NULL) {
+		return NULL;
+	}
+	q->items = malloc(length * item_size);
+	if (q->items == NULL) {
+		free(q);
+		return NULL;
+	}
+	q->item_size = item_size;
+	q->length = length;
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->changed, NULL);
+	return q;
+}
+
+void vQueueDelete(QueueHandle_t q) {
+	pthread_mutex_destroy(&q->lock);
+	pthread_cond_destroy(&q->changed);
+	free(q->items);
+	free(q);
+}
+
+BaseType_t xQueueReset(QueueHandle_t q) {
+	pthread_mutex_lock(&q->lock);
+	q->head = 0;
+	q->count = 0;
+	pthread_cond_broadcast(&q->changed);
+	pthread_mutex_unlock(&q->lock);
+	return pdTRUE;
+}
+
+// Wait until ready() holds, for at most wait ticks. Called with the lock held.
+static bool wait_for(QueueHandle_t q, bool (*ready)(QueueHandle_t),
+		TickType_t wait) {
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += wait / 1000;
+	deadline.tv_nsec += (long) (wait % 1000) * 1000000;
+	if (deadline.tv_nsec >= 1000000000) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+	while (!ready(q)) {
+		if (wait == 0) {
+			return false;
+		}
+		if (wait == portMAX_DELAY) {
+			pthread_cond_wait(&q->changed, &q->lock);
+		} else if (pthread_cond_timedwait(&q->changed, &q->lock, &deadline)
+				== ETIMEDOUT) {
+			return ready(q);
+		}
+	}
+	return true;
+}
+
+static bool has_space(QueueHandle_t q) {
+	return q->count < q->length;
+}
+
+static bool has_item(QueueHandle_t q) {
+	return q->count > 0;
+}
+
+BaseType_t xQueueSend(QueueHandle_t q, const void* item, TickType_t wait) {
+	pthread_mutex_lock(&q->lock);
+	bool ok = wait_for(q, &has_space, wait);
+	if (ok) {
+		size_t tail = (q->head + q->count) % q->length;
+		memcpy(q->items + tail * q->item_size, item, q->item_size);
+		q->count++;
+		pthread_cond_broadcast(&q->changed);
+	}
+	pthread_mutex_unlock(&q->lock);
+	return ok ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t q, void* item, TickType_t wait) {
+	pthread_mutex_lock(&q->lock);
+	bool ok = wait_for(q, &has_item, wait);
+	if (ok) {
+		memcpy(item, q->items + q->head * q->item_size, q->item_size);
+		q->head = (q->head + 1) % q->length;
+		q->count--;
+		pthread_cond_broadcast(&q->changed);
+	}
+	pthread_mutex_unlock(&q->lock);
+	return ok ? pdTRUE : pdFALSE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q) {
+	pthread_mutex_lock(&q->lock);
+	UBaseType_t count = q->count;
+	pthread_mutex_unlock(&q->lock);
+	return count;
+}
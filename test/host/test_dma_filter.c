@@ -0,0 +1,180 @@
+// Copyright 2015-2016 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Golden test of every DMA filter compiled into dma_filter.c: each one is
+// run over synthetic DMA buffers of every frame size and sampling mode,
+// at every destination alignment, and must match the reference filter
+// of dma_synth.c byte for byte without writing past its output.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dma_synth.h"
+
+#define GUARD       0xa5
+#define GUARD_LEN   16
+
+static const i2s_sampling_mode_t s_modes[] = { SM_0A0B_0B0C, SM_0A0B_0C0D,
+		SM_0A00_0B00 };
+static const size_t s_hdecim[] = { 1, 2, 4 };
+
+static int s_failures;
+
+static void fail(const char* what, i2s_sampling_mode_t mode,
+		dma_filter_layout_t layout, size_t hdecim, bool box, size_t width,
+		size_t align, size_t b) {
+	if (s_failures++ < 20) {
+		printf("FAIL %s: %s %s hdecim %zu box %d, width %zu, dst offset %zu, "
+				"buffer %zu\n", what, synth_mode_name(mode),
+				synth_layout_name(layout), hdecim, box, width, align, b);
+	}
+}
+
+static bool guard_intact(const uint8_t* p) {
+	for (size_t i = 0; i < GUARD_LEN; ++i) {
+		if (p[i] != GUARD) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// One line of width pixels through filter, buffer by buffer
+static void check_line(dma_filter_t filter, i2s_sampling_mode_t mode,
+		dma_filter_layout_t layout, size_t hdecim, bool box, size_t width) {
+	synth_line_t line;
+	synth_line_init(&line, mode, width, 2);
+	if ((width / line.dma_per_line) % hdecim != 0) {
+		// dma_geometry() rejects this decimation at this width
+		return;
+	}
+	uint8_t* data = malloc(line.line_bytes + 1);
+	uint32_t* words = malloc(line.buf_bytes * 4);
+	uint8_t* expect = malloc(line.buf_bytes * 3 + 4);
+	uint8_t* out = malloc(line.buf_bytes * 3 + 4 + GUARD_LEN);
+	uint32_t seed = (uint32_t) (width * 31 + layout * 7 + hdecim);
+	synth_random(&seed, data, line.line_bytes);
+
+	for (size_t b = 0; b < line.dma_per_line; ++b) {
+		synth_buf(&line, data, b, words);
+		size_t n = ref_filter(data + b * line.buf_bytes, line.buf_bytes,
+				layout, hdecim, box, expect);
+		for (size_t align = 0; align < 4; ++align) {
+			memset(out, GUARD, n + align + GUARD_LEN);
+			filter((const dma_elem_t*) words, synth_buf_len(&line, b),
+					out + align);
+			if (memcmp(out + align, expect, n) != 0) {
+				fail("output", mode, layout, hdecim, box, width, align, b);
+			}
+			if (!guard_intact(out + align + n)) {
+				fail("overrun", mode, layout, hdecim, box, width, align, b);
+			}
+		}
+	}
+	free(data);
+	free(words);
+	free(expect);
+	free(out);
+}
+
+static void check_planar_line(dma_filter_planar_t filter,
+		i2s_sampling_mode_t mode, size_t width) {
+	synth_line_t line;
+	synth_line_init(&line, mode, width, 2);
+	uint8_t* data = malloc(line.line_bytes);
+	uint32_t* words = malloc(line.buf_bytes * 4);
+	size_t pixels = line.buf_bytes / 2;
+	uint8_t* ey = malloc(pixels);
+	uint8_t* eu = malloc(pixels / 2);
+	uint8_t* ev = malloc(pixels / 2);
+	uint8_t* y = malloc(pixels + 4 + GUARD_LEN);
+	uint8_t* u = malloc(pixels / 2 + GUARD_LEN);
+	uint8_t* v = malloc(pixels / 2 + GUARD_LEN);
+	uint32_t seed = (uint32_t) width;
+	synth_random(&seed, data, line.line_bytes);
+
+	for (size_t b = 0; b < line.dma_per_line; ++b) {
+		synth_buf(&line, data, b, words);
+		ref_filter_planar(data + b * line.buf_bytes, line.buf_bytes, ey, eu, ev);
+		for (size_t align = 0; align < 4; ++align) {
+			memset(y, GUARD, pixels + align + GUARD_LEN);
+			memset(u, GUARD, pixels / 2 + GUARD_LEN);
+			memset(v, GUARD, pixels / 2 + GUARD_LEN);
+			filter((const dma_elem_t*) words, synth_buf_len(&line, b),
+					y + align, u, v);
+			if (memcmp(y + align, ey, pixels) != 0
+					|| memcmp(u, eu, pixels / 2) != 0
+					|| memcmp(v, ev, pixels / 2) != 0) {
+				fail("planar output", mode, DMA_FILTER_RAW, 1, false, width,
+						align, b);
+			}
+			if (!guard_intact(y + align + pixels)
+					|| !guard_intact(u + pixels / 2)
+					|| !guard_intact(v + pixels / 2)) {
+				fail("planar overrun", mode, DMA_FILTER_RAW, 1, false, width,
+						align, b);
+			}
+		}
+	}
+	free(data);
+	free(words);
+	free(ey);
+	free(eu);
+	free(ev);
+	free(y);
+	free(u);
+	free(v);
+}
+
+int main() {
+	size_t filters = 0;
+	for (size_t m = 0; m < sizeof(s_modes) / sizeof(s_modes[0]); ++m) {
+		for (int layout = DMA_FILTER_Y8; layout <= DMA_FILTER_RGB565_LE;
+				++layout) {
+			for (size_t d = 0; d < sizeof(s_hdecim) / sizeof(s_hdecim[0]);
+					++d) {
+				for (int box = 0; box < 2; ++box) {
+					dma_filter_t filter = dma_filter_get(s_modes[m], layout,
+							s_hdecim[d], box);
+					if (filter == NULL) {
+						continue;
+					}
+					filters++;
+					for (size_t r = 0; r < synth_resolution_count; ++r) {
+						check_line(filter, s_modes[m], layout, s_hdecim[d], box,
+								synth_resolution[r][0]);
+					}
+				}
+			}
+		}
+		dma_filter_planar_t planar = dma_filter_planar_get(s_modes[m]);
+		if (planar != NULL) {
+			filters++;
+			for (size_t r = 0; r < synth_resolution_count; ++r) {
+				check_planar_line(planar, s_modes[m], synth_resolution[r][0]);
+			}
+		}
+	}
+	printf("%zu filters checked at %zu frame sizes\n", filters,
+			synth_resolution_count);
+	if (filters == 0) {
+		printf("FAIL: no filters compiled in\n");
+		return 1;
+	}
+	if (s_failures != 0) {
+		printf("FAIL: %d mismatches\n", s_failures);
+		return 1;
+	}
+	printf("PASS\n");
+	return 0;
+}
@@ -0,0 +1,86 @@
+// Copyright 2015-2016 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Golden test of the dma_filter.c filters against the byte-wise filters
+// they replaced: same synthetic DMA buffers, every frame size, every
+// destination alignment, byte for byte the same output.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dma_synth.h"
+#include "dma_filter_bytewise.h"
+
+static int s_failures;
+
+static void check_line(const bytewise_filter_t* old, dma_filter_t filter,
+		size_t width) {
+	synth_line_t line;
+	synth_line_init(&line, old->mode, width, 2);
+	uint8_t* data = malloc(line.line_bytes);
+	uint32_t* words = malloc(line.buf_bytes * 4);
+	uint8_t* expect = malloc(line.buf_bytes * 3 + 8);
+	uint8_t* out = malloc(line.buf_bytes * 3 + 8);
+	uint32_t seed = (uint32_t) width;
+	synth_random(&seed, data, line.line_bytes);
+
+	for (size_t b = 0; b < line.dma_per_line; ++b) {
+		synth_buf(&line, data, b, words);
+		size_t len = synth_buf_len(&line, b);
+		size_t n = ref_filter(data + b * line.buf_bytes, line.buf_bytes,
+				old->layout, 1, false, expect);
+		// the byte-wise output replaces the reference, except for the last
+		// two pixels of a short SM_0A0B_0B0C grayscale buffer: the old tail
+		// handling wrote two of the last four pixels, the new filters write
+		// all of them
+		old->filter((const dma_elem_t*) words, len, expect);
+		for (size_t align = 0; align < 4; ++align) {
+			memset(out + align, 0, n);
+			filter((const dma_elem_t*) words, len, out + align);
+			if (memcmp(out + align, expect, n) != 0) {
+				if (s_failures++ < 20) {
+					printf("FAIL %s %s: width %zu, dst offset %zu, buffer %zu\n",
+							old->name, synth_mode_name(old->mode), width,
+							align, b);
+				}
+			}
+		}
+	}
+	free(data);
+	free(words);
+	free(expect);
+	free(out);
+}
+
+int main() {
+	for (size_t i = 0; i < bytewise_filter_count; ++i) {
+		const bytewise_filter_t* old = &bytewise_filters[i];
+		dma_filter_t filter = dma_filter_get(old->mode, old->layout, 1, false);
+		if (filter == NULL) {
+			printf("FAIL %s %s: no dma_filter.c filter\n", old->name,
+					synth_mode_name(old->mode));
+			s_failures++;
+			continue;
+		}
+		for (size_t r = 0; r < synth_resolution_count; ++r) {
+			check_line(old, filter, synth_resolution[r][0]);
+		}
+	}
+	if (s_failures != 0) {
+		printf("FAIL: %d mismatches\n", s_failures);
+		return 1;
+	}
+	printf("%zu byte-wise filters matched at %zu frame sizes\nPASS\n",
+			bytewise_filter_count, synth_resolution_count);
+	return 0;
+}
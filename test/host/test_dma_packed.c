@@ -0,0 +1,168 @@
+// Copyright 2015-2016 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Golden cases for CONFIG_CAMERA_DMA_PACKED: RGB565 and JPEG sampled two
+// bytes per DMA word (SM_0A0B_0C0D) must give the same frame buffer as
+// one byte per word (SM_0A00_0B00), from half the DMA data.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dma_synth.h"
+
+#define FRAME_LINES 4
+
+static const dma_filter_layout_t s_rgb565_layouts[] = { DMA_FILTER_BGR888,
+		DMA_FILTER_RGB888, DMA_FILTER_RGB565_BE, DMA_FILTER_RGB565_LE };
+static const size_t s_hdecim[] = { 1, 2, 4 };
+
+static int s_failures;
+
+typedef struct {
+	dma_filter_layout_t layout;
+	size_t hdecim;
+	size_t width;
+	size_t height;
+} frame_t;
+
+// Filter a frame whose camera bytes are in data, line by line and buffer
+// by buffer as the filter task does. Returns the frame buffer bytes
+// written, or 0 if the filter is not compiled in, and adds the DMA bytes
+// read to *dma_bytes.
+static size_t filter_frame(const frame_t* f, i2s_sampling_mode_t mode,
+		const uint8_t* data, uint8_t* out, size_t* dma_bytes) {
+	dma_filter_t filter = dma_filter_get(mode, f->layout, f->hdecim, false);
+	if (filter == NULL) {
+		return 0;
+	}
+	synth_line_t line;
+	synth_line_init(&line, mode, f->width, 2);
+	uint32_t* words = malloc(line.buf_bytes * 4);
+	uint8_t* scratch = malloc(line.buf_bytes * 3);
+	uint8_t* start = out;
+	for (size_t y = 0; y < f->height; ++y) {
+		const uint8_t* src = data + y * line.line_bytes;
+		for (size_t b = 0; b < line.dma_per_line; ++b) {
+			synth_buf(&line, src, b, words);
+			size_t len = synth_buf_len(&line, b);
+			filter((const dma_elem_t*) words, len, out);
+			out += ref_filter(src + b * line.buf_bytes, line.buf_bytes,
+					f->layout, f->hdecim, false, scratch);
+			*dma_bytes += len;
+		}
+	}
+	free(words);
+	free(scratch);
+	return out - start;
+}
+
+// Packed and unpacked sampling of the same camera bytes
+static void check_frame(const frame_t* f, const uint8_t* data,
+		const char* what) {
+	size_t size = f->width * 3 * f->height;
+	uint8_t* packed = malloc(size);
+	uint8_t* unpacked = malloc(size);
+	size_t packed_dma = 0;
+	size_t unpacked_dma = 0;
+	size_t n = filter_frame(f, SM_0A0B_0C0D, data, packed, &packed_dma);
+	size_t m = filter_frame(f, SM_0A00_0B00, data, unpacked, &unpacked_dma);
+	if (n == 0 || n != m || memcmp(packed, unpacked, n) != 0) {
+		printf("FAIL %s %s /%zu, %zux%zu: packed output differs\n", what,
+				synth_layout_name(f->layout), f->hdecim, f->width, f->height);
+		s_failures++;
+	} else if (packed_dma * 2 != unpacked_dma) {
+		printf("FAIL %s %s /%zu, %zux%zu: %zu DMA bytes packed, %zu not\n",
+				what, synth_layout_name(f->layout), f->hdecim, f->width,
+				f->height, packed_dma, unpacked_dma);
+		s_failures++;
+	}
+	free(packed);
+	free(unpacked);
+}
+
+static void check_rgb565() {
+	for (size_t r = 0; r < synth_resolution_count; ++r) {
+		frame_t f = { .width = synth_resolution[r][0], .height = FRAME_LINES };
+		uint8_t* data = malloc(f.width * 2 * f.height);
+		uint32_t seed = (uint32_t) f.width;
+		synth_random(&seed, data, f.width * 2 * f.height);
+		for (size_t l = 0; l < sizeof(s_rgb565_layouts)
+				/ sizeof(s_rgb565_layouts[0]); ++l) {
+			for (size_t d = 0; d < sizeof(s_hdecim) / sizeof(s_hdecim[0]);
+					++d) {
+				f.layout = s_rgb565_layouts[l];
+				f.hdecim = s_hdecim[d];
+				synth_line_t line;
+				synth_line_init(&line, SM_0A00_0B00, f.width, 2);
+				if ((f.width / line.dma_per_line) % f.hdecim == 0) {
+					check_frame(&f, data, "RGB565");
+				}
+			}
+		}
+		free(data);
+	}
+}
+
+// A JPEG-like stream: SOI, segments with byte stuffing and markers split
+// across DMA buffers and lines, EOI, then the padding the sensor sends
+// until the end of the frame. The raw packed filter must hand it over
+// unchanged, EOI included.
+static void check_jpeg() {
+	for (size_t r = 0; r < synth_resolution_count; ++r) {
+		frame_t f = { .layout = DMA_FILTER_RAW, .hdecim = 1,
+				.width = synth_resolution[r][0], .height = FRAME_LINES };
+		size_t size = f.width * 2 * f.height;
+		uint8_t* data = malloc(size);
+		uint32_t seed = (uint32_t) f.width;
+		synth_random(&seed, data, size);
+		for (size_t i = 0; i < size; ++i) {
+			if (data[i] == 0xff) {
+				data[i + 1 < size ? i + 1 : i] = 0x00;
+			}
+		}
+		data[0] = 0xff;
+		data[1] = 0xd8;
+		// a marker straddling the first buffer boundary
+		synth_line_t line;
+		synth_line_init(&line, SM_0A0B_0C0D, f.width, 2);
+		data[line.buf_bytes - 1] = 0xff;
+		data[line.buf_bytes] = 0xdb;
+		size_t eoi = size - f.width / 2 - 1;
+		data[eoi] = 0xff;
+		data[eoi + 1] = 0xd9;
+		memset(data + eoi + 2, 0, size - eoi - 2);
+
+		check_frame(&f, data, "JPEG");
+		uint8_t* out = malloc(size);
+		size_t dma_bytes = 0;
+		size_t n = filter_frame(&f, SM_0A0B_0C0D, data, out, &dma_bytes);
+		if (n != size || memcmp(out, data, size) != 0) {
+			printf("FAIL JPEG %zux%zu: packed stream differs\n", f.width,
+					f.height);
+			s_failures++;
+		}
+		free(out);
+		free(data);
+	}
+}
+
+int main() {
+	check_rgb565();
+	check_jpeg();
+	if (s_failures != 0) {
+		printf("FAIL: %d mismatches\n", s_failures);
+		return 1;
+	}
+	printf("PASS\n");
+	return 0;
+}
@@ -0,0 +1,262 @@
+// Copyright 2015-2016 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Frame buffer allocator (fb_alloc.c) against a mock heap with a byte
+// budget per policy: chain order and fallback, statistics, the static
+// buffer, and adaptive resizing, which must not use up static space.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fb_alloc.h"
+
+static int s_failures;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+		s_failures++; \
+	} \
+} while (0)
+
+#define MAX_LIVE 64
+
+typedef struct {
+	size_t budget;
+	size_t used;
+	size_t live;
+	struct {
+		void* ptr;
+		size_t size;
+	} blocks[MAX_LIVE];
+} mock_heap_t;
+
+static mock_heap_t s_heaps[FB_POLICY_COUNT];
+
+static void* mock_alloc(fb_policy_t policy, size_t size) {
+	mock_heap_t* h = &s_heaps[policy];
+	if (h->used + size > h->budget || h->live == MAX_LIVE) {
+		return NULL;
+	}
+	void* ptr = malloc(size);
+	memset(ptr, 0xee, size);
+	h->blocks[h->live].ptr = ptr;
+	h->blocks[h->live].size = size;
+	h->live++;
+	h->used += size;
+	return ptr;
+}
+
+static void mock_free(fb_policy_t policy, void* ptr) {
+	mock_heap_t* h = &s_heaps[policy];
+	for (size_t i = 0; i < h->live; ++i) {
+		if (h->blocks[i].ptr == ptr) {
+			h->used -= h->blocks[i].size;
+			h->blocks[i] = h->blocks[--h->live];
+			free(ptr);
+			return;
+		}
+	}
+	printf("FAIL: free of an unknown block\n");
+	s_failures++;
+}
+
+static size_t mock_largest_free(fb_policy_t policy) {
+	return s_heaps[policy].budget - s_heaps[policy].used;
+}
+
+static const fb_heap_ops_t s_mock_ops = {
+	.alloc = &mock_alloc,
+	.free = &mock_free,
+	.largest_free = &mock_largest_free,
+};
+
+static void mock_reset(size_t internal, size_t spiram) {
+	memset(s_heaps, 0, sizeof(s_heaps));
+	s_heaps[FB_POLICY_INTERNAL].budget = internal;
+	s_heaps[FB_POLICY_SPIRAM].budget = spiram;
+}
+
+static bool zeroed(const fb_block_t* block) {
+	for (size_t i = 0; i < block->size; ++i) {
+		if (((const uint8_t*) block->ptr)[i] != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void test_chain() {
+	fb_allocator_t a;
+	fb_block_t b[3];
+	const fb_policy_t empty[FB_CHAIN_MAX] = { FB_POLICY_NONE };
+	mock_reset(1000, 0);
+	fb_alloc_init(&a, &s_mock_ops, empty, NULL, 0);
+	// an empty chain means internal RAM only
+	CHECK(fb_alloc(&a, 600, &b[0]));
+	CHECK(b[0].policy == FB_POLICY_INTERNAL && b[0].size == 600);
+	CHECK(zeroed(&b[0]));
+	CHECK(!fb_alloc(&a, 600, &b[1]));
+	CHECK(b[1].policy == FB_POLICY_NONE && b[1].ptr == NULL);
+	CHECK(a.stats[FB_POLICY_INTERNAL].allocs == 1);
+	CHECK(a.stats[FB_POLICY_INTERNAL].failures == 1);
+	CHECK(a.stats[FB_POLICY_INTERNAL].bytes == 600);
+	CHECK(a.stats[FB_POLICY_INTERNAL].largest_free == 400);
+	fb_free(&a, &b[0]);
+	fb_free(&a, &b[1]);       // not allocated, nothing happens
+	CHECK(a.stats[FB_POLICY_INTERNAL].bytes == 0);
+	CHECK(s_heaps[FB_POLICY_INTERNAL].live == 0);
+
+	// internal first, SPI RAM once internal is full
+	const fb_policy_t chain[FB_CHAIN_MAX] = { FB_POLICY_INTERNAL,
+			FB_POLICY_SPIRAM };
+	mock_reset(1000, 5000);
+	fb_alloc_init(&a, &s_mock_ops, chain, NULL, 0);
+	CHECK(fb_alloc(&a, 800, &b[0]) && b[0].policy == FB_POLICY_INTERNAL);
+	CHECK(fb_alloc(&a, 800, &b[1]) && b[1].policy == FB_POLICY_SPIRAM);
+	CHECK(fb_alloc(&a, 800, &b[2]) && b[2].policy == FB_POLICY_SPIRAM);
+	CHECK(a.stats[FB_POLICY_INTERNAL].failures == 2);
+	CHECK(a.stats[FB_POLICY_SPIRAM].bytes == 1600);
+	for (int i = 0; i < 3; ++i) {
+		fb_free(&a, &b[i]);
+	}
+	CHECK(s_heaps[FB_POLICY_INTERNAL].live == 0);
+	CHECK(s_heaps[FB_POLICY_SPIRAM].live == 0);
+}
+
+static void test_static() {
+	fb_allocator_t a;
+	fb_block_t b[3];
+	static uint32_t buf[256];
+	uint8_t* start = (uint8_t*) buf + 1;
+	const fb_policy_t chain[FB_CHAIN_MAX] = { FB_POLICY_STATIC,
+			FB_POLICY_INTERNAL };
+	mock_reset(1000, 0);
+	memset(buf, 0xee, sizeof(buf));
+	// a misaligned buffer loses its first bytes to alignment
+	fb_alloc_init(&a, &s_mock_ops, chain, start, 1021);
+	CHECK(a.static_size == 1018);
+	CHECK(fb_alloc(&a, 401, &b[0]) && b[0].policy == FB_POLICY_STATIC);
+	CHECK(((uintptr_t) b[0].ptr & 3) == 0);
+	CHECK(zeroed(&b[0]));
+	CHECK(fb_alloc(&a, 400, &b[1]) && b[1].policy == FB_POLICY_STATIC);
+	CHECK(((uintptr_t) b[1].ptr & 3) == 0);
+	CHECK((uint8_t*) b[1].ptr >= (uint8_t*) b[0].ptr + 401);
+	// static space is used up, the chain goes on to internal RAM
+	CHECK(fb_alloc(&a, 400, &b[2]) && b[2].policy == FB_POLICY_INTERNAL);
+	CHECK(a.stats[FB_POLICY_STATIC].failures == 1);
+	// static space comes back once every static block is freed
+	fb_free(&a, &b[0]);
+	CHECK(a.static_used != 0);
+	fb_free(&a, &b[1]);
+	CHECK(a.static_used == 0);
+	fb_free(&a, &b[2]);
+	CHECK(fb_alloc(&a, 1000, &b[0]) && b[0].policy == FB_POLICY_STATIC);
+	fb_free(&a, &b[0]);
+}
+
+static void test_realloc() {
+	fb_allocator_t a;
+	fb_block_t b[2];
+	static uint32_t buf[256];
+	const fb_policy_t chain[FB_CHAIN_MAX] = { FB_POLICY_STATIC,
+			FB_POLICY_INTERNAL };
+	mock_reset(4000, 0);
+	fb_alloc_init(&a, &s_mock_ops, chain, (uint8_t*) buf, sizeof(buf));
+	CHECK(fb_alloc(&a, 400, &b[0]) && b[0].policy == FB_POLICY_STATIC);
+	CHECK(fb_alloc(&a, 400, &b[1]) && b[1].policy == FB_POLICY_STATIC);
+	void* first = b[0].ptr;
+	void* last = b[1].ptr;
+
+	// shrinking keeps a static block in place, and it can grow back
+	CHECK(fb_realloc(&a, &b[0], 100));
+	CHECK(b[0].ptr == first && b[0].size == 400);
+	CHECK(fb_realloc(&a, &b[0], 400) && b[0].ptr == first);
+	// the block carved last grows in place while the buffer has room
+	CHECK(fb_realloc(&a, &b[1], 600));
+	CHECK(b[1].ptr == last && b[1].size == 600);
+	CHECK(a.stats[FB_POLICY_STATIC].bytes == 1000);
+	// past the buffer, and for any other block, it moves to the heap
+	CHECK(fb_realloc(&a, &b[1], 700));
+	CHECK(b[1].policy == FB_POLICY_INTERNAL && b[1].size == 700);
+	CHECK(fb_realloc(&a, &b[0], 500));
+	CHECK(b[0].policy == FB_POLICY_INTERNAL);
+	CHECK(a.stats[FB_POLICY_STATIC].bytes == 0);
+	CHECK(a.static_used == 0);
+	// heap blocks are replaced, the old one is freed, before the new one
+	// is allocated when shrinking
+	CHECK(fb_realloc(&a, &b[0], 300) && b[0].size == 300);
+	CHECK(s_heaps[FB_POLICY_INTERNAL].live == 2);
+	CHECK(s_heaps[FB_POLICY_INTERNAL].used == 1000);
+	// a size nothing can hold leaves the block as it was
+	CHECK(!fb_realloc(&a, &b[0], 5000));
+	CHECK(b[0].policy == FB_POLICY_INTERNAL && b[0].size == 300);
+	fb_free(&a, &b[0]);
+	fb_free(&a, &b[1]);
+	CHECK(s_heaps[FB_POLICY_INTERNAL].live == 0);
+
+	// a heap with room for one block: growing needs both at once and fails,
+	// shrinking reuses the space of the old block
+	const fb_policy_t internal[FB_CHAIN_MAX] = { FB_POLICY_INTERNAL };
+	mock_reset(1000, 0);
+	fb_alloc_init(&a, &s_mock_ops, internal, NULL, 0);
+	CHECK(fb_alloc(&a, 800, &b[0]));
+	CHECK(!fb_realloc(&a, &b[0], 900));
+	CHECK(b[0].policy == FB_POLICY_INTERNAL && b[0].size == 800);
+	CHECK(fb_realloc(&a, &b[0], 600));
+	CHECK(b[0].policy == FB_POLICY_INTERNAL && b[0].size == 600);
+	CHECK(zeroed(&b[0]));
+	CHECK(s_heaps[FB_POLICY_INTERNAL].live == 1);
+	CHECK(a.stats[FB_POLICY_INTERNAL].bytes == 600);
+	fb_free(&a, &b[0]);
+	CHECK(s_heaps[FB_POLICY_INTERNAL].live == 0);
+}
+
+// Adaptive JPEG frame buffers resize every few frames. With static blocks
+// only, that must keep working for as long as sizes fit the reservation.
+static void test_adaptive_static() {
+	fb_allocator_t a;
+	fb_block_t b[2];
+	static uint32_t buf[1024];
+	const fb_policy_t chain[FB_CHAIN_MAX] = { FB_POLICY_STATIC };
+	mock_reset(0, 0);
+	fb_alloc_init(&a, &s_mock_ops, chain, (uint8_t*) buf, sizeof(buf));
+	CHECK(fb_alloc(&a, 2048, &b[0]));
+	CHECK(fb_alloc(&a, 2048, &b[1]));
+	uint32_t seed = 1;
+	size_t failures = 0;
+	for (int i = 0; i < 10000; ++i) {
+		seed = seed * 1103515245 + 12345;
+		size_t size = 256 + (seed >> 16) % 1792;
+		failures += !fb_realloc(&a, &b[i & 1], size);
+	}
+	CHECK(failures == 0);
+	CHECK(a.static_used <= sizeof(buf));
+	CHECK(b[0].policy == FB_POLICY_STATIC && b[1].policy == FB_POLICY_STATIC);
+	fb_free(&a, &b[0]);
+	fb_free(&a, &b[1]);
+	CHECK(a.static_used == 0);
+}
+
+int main() {
+	test_chain();
+	test_static();
+	test_realloc();
+	test_adaptive_static();
+	if (s_failures != 0) {
+		printf("FAIL: %d checks\n", s_failures);
+		return 1;
+	}
+	printf("PASS\n");
+	return 0;
+}
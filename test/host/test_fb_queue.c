@@ -0,0 +1,235 @@
+// Copyright 2015-2016 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Streaming frame buffer pool (fb_queue.c) against the host queue shim.
+// First the recycling policy step by step, then a simulated DMA producer
+// thread filling frames line by line while a consumer holds, checks and
+// returns them at random. No frame may be written while the consumer
+// holds it, frames arrive in order and intact, and every frame is either
+// delivered or counted as dropped.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include "fb_queue.h"
+
+#define POOL_MAX        4
+#define FRAME_LINES     32
+#define LINE_WORDS      64
+#define FRAMES          2000
+
+static int s_failures;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+		s_failures++; \
+	} \
+} while (0)
+
+typedef struct {
+	size_t seq;
+	atomic_bool held;           // by the consumer
+	uint32_t data[FRAME_LINES][LINE_WORDS];
+} frame_t;
+
+static void test_policy() {
+	frame_t frames[3];
+	frame_t* a = &frames[0];
+	frame_t* b = &frames[1];
+	frame_t* c = &frames[2];
+	fb_queue_t q;
+	size_t dropped = 0;
+	CHECK(fb_queue_create(&q, 3));
+	fb_queue_reset(&q);
+	// capture starts in a, the others are free
+	fb_queue_release(&q, b);
+	fb_queue_release(&q, c);
+
+	CHECK(fb_queue_frame_done(&q, a, &dropped) == b);
+	CHECK(fb_queue_get(&q, 0) == a);
+	CHECK(fb_queue_frame_done(&q, b, &dropped) == c);
+	CHECK(dropped == 0);
+	// consumer holds a: the oldest filled frame is recycled
+	CHECK(fb_queue_frame_done(&q, c, &dropped) == b);
+	CHECK(dropped == 1);
+	CHECK(fb_queue_frame_done(&q, b, &dropped) == c);
+	CHECK(dropped == 2);
+	CHECK(fb_queue_get(&q, 0) == b);
+	// consumer holds a and b: capture overwrites c
+	CHECK(fb_queue_frame_done(&q, c, &dropped) == c);
+	CHECK(dropped == 3);
+	CHECK(fb_queue_get(&q, 0) == NULL);
+	fb_queue_release(&q, a);
+	CHECK(fb_queue_frame_done(&q, c, &dropped) == a);
+	CHECK(fb_queue_get(&q, 0) == c);
+	CHECK(fb_queue_get(&q, 10) == NULL);
+	CHECK(dropped == 3);
+
+	// reset takes every buffer back
+	fb_queue_reset(&q);
+	CHECK(fb_queue_get(&q, 0) == NULL);
+	CHECK(fb_queue_frame_done(&q, a, &dropped) == a);
+	fb_queue_delete(&q);
+}
+
+typedef struct {
+	fb_queue_t q;
+	size_t count;
+	frame_t frames[POOL_MAX];
+	atomic_bool stop;
+	size_t produced;
+	size_t dropped;
+	size_t delivered;
+	size_t overwrites;          // lines written into a held frame
+	size_t corrupt;             // frames delivered with wrong contents
+	size_t out_of_order;
+} sim_t;
+
+static uint32_t pattern(size_t seq, size_t line, size_t word) {
+	return (uint32_t) (seq * 2654435761u) ^ (uint32_t) (line << 16 | word);
+}
+
+static uint32_t rnd(uint32_t* state) {
+	*state = *state * 1103515245 + 12345;
+	return *state >> 16;
+}
+
+// Capture: fill the current frame line by line, as the filter task does
+// from DMA buffers, then hand it over
+static void* producer(void* arg) {
+	sim_t* s = (sim_t*) arg;
+	frame_t* cur = &s->frames[0];
+	uint32_t seed = 1;
+	for (size_t seq = 0; seq < FRAMES; ++seq) {
+		for (size_t y = 0; y < FRAME_LINES; ++y) {
+			if (atomic_load(&cur->held)) {
+				s->overwrites++;
+			}
+			for (size_t x = 0; x < LINE_WORDS; ++x) {
+				cur->data[y][x] = pattern(seq, y, x);
+			}
+			if (rnd(&seed) % 8 == 0) {
+				sched_yield();
+			}
+		}
+		cur->seq = seq;
+		s->produced++;
+		cur = (frame_t*) fb_queue_frame_done(&s->q, cur, &s->dropped);
+		// vertical blanking
+		nanosleep(&(struct timespec) { .tv_nsec = 50000 }, NULL);
+	}
+	atomic_store(&s->stop, true);
+	return NULL;
+}
+
+static bool intact(const frame_t* f) {
+	for (size_t y = 0; y < FRAME_LINES; ++y) {
+		for (size_t x = 0; x < LINE_WORDS; ++x) {
+			if (f->data[y][x] != pattern(f->seq, y, x)) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+// Consumer: hold up to count - 1 frames, check them while capture runs,
+// return them oldest first
+static void* consumer(void* arg) {
+	sim_t* s = (sim_t*) arg;
+	frame_t* held[POOL_MAX];
+	size_t nheld = 0;
+	size_t next_seq = 0;
+	uint32_t seed = 2;
+	while (true) {
+		bool stopped = atomic_load(&s->stop);
+		frame_t* f = (frame_t*) fb_queue_get(&s->q, stopped ? 0 : 1);
+		if (f == NULL && stopped) {
+			break;
+		}
+		// keep a random number of frames, none once capture has nothing new
+		size_t keep = 0;
+		if (f != NULL) {
+			atomic_store(&f->held, true);
+			s->delivered++;
+			if (f->seq < next_seq) {
+				s->out_of_order++;
+			}
+			next_seq = f->seq + 1;
+			held[nheld++] = f;
+			// hold frames for up to about two frame times
+			nanosleep(&(struct timespec) { .tv_nsec = rnd(&seed) % 100000 },
+					NULL);
+			keep = rnd(&seed) % s->count;
+		}
+		while (nheld > keep) {
+			frame_t* done = held[0];
+			if (!intact(done)) {
+				s->corrupt++;
+			}
+			memmove(held, held + 1, --nheld * sizeof(held[0]));
+			atomic_store(&done->held, false);
+			fb_queue_release(&s->q, done);
+		}
+	}
+	for (size_t i = 0; i < nheld; ++i) {
+		if (!intact(held[i])) {
+			s->corrupt++;
+		}
+	}
+	return NULL;
+}
+
+static void test_producer(size_t count) {
+	sim_t* s = calloc(1, sizeof(sim_t));
+	s->count = count;
+	CHECK(fb_queue_create(&s->q, count));
+	fb_queue_reset(&s->q);
+	for (size_t i = 1; i < count; ++i) {
+		fb_queue_release(&s->q, &s->frames[i]);
+	}
+	pthread_t p, c;
+	pthread_create(&c, NULL, &consumer, s);
+	pthread_create(&p, NULL, &producer, s);
+	pthread_join(p, NULL);
+	pthread_join(c, NULL);
+
+	printf("%zu buffers: %zu frames, %zu delivered, %zu dropped\n", count,
+			s->produced, s->delivered, s->dropped);
+	CHECK(s->produced == FRAMES);
+	CHECK(s->delivered + s->dropped == s->produced);
+	CHECK(s->delivered > 0);
+	CHECK(s->overwrites == 0);
+	CHECK(s->corrupt == 0);
+	CHECK(s->out_of_order == 0);
+	fb_queue_delete(&s->q);
+	free(s);
+}
+
+int main() {
+	test_policy();
+	for (size_t count = 2; count <= POOL_MAX; ++count) {
+		test_producer(count);
+	}
+	if (s_failures != 0) {
+		printf("FAIL: %d checks\n", s_failures);
+		return 1;
+	}
+	printf("PASS\n");
+	return 0;
+}
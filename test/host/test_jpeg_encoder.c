@@ -0,0 +1,116 @@
+// Copyright 2015-2016 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Software JPEG encoder (jpeg_encoder.c) against libjpeg. Every sampling
+// mode and a range of qualities must decode without warnings at the right
+// size and come within 1 dB of libjpeg's own encoding of the same image.
+// Sizes which are not a multiple of the MCU, with a short last strip,
+// must decode too, and output which does not fit must be cut short at the
+// buffer size with overflow set.
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "jpeg_ref.h"
+
+#define WIDTH   640
+#define HEIGHT  480
+
+static int s_failures;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+		s_failures++; \
+	} \
+} while (0)
+
+static const char* sampling_name(jpeg_enc_sampling_t sampling) {
+	switch (sampling) {
+		case JPEG_ENC_GRAY:   return "gray";
+		case JPEG_ENC_YUV422: return "YUV422";
+		case JPEG_ENC_YUV420: return "YUV420";
+	}
+	return "?";
+}
+
+static void test_quality(const ref_image_t* img, uint8_t* out, uint8_t* dec) {
+	size_t out_size = WIDTH * HEIGHT * 3;
+	for (int s = JPEG_ENC_GRAY; s <= JPEG_ENC_YUV420; ++s) {
+		jpeg_enc_sampling_t sampling = (jpeg_enc_sampling_t) s;
+		for (int q = 10; q <= 100; q += 30) {
+			jpeg_encoder_t enc;
+			jpeg_enc_init(&enc, WIDTH, HEIGHT, sampling, q);
+			size_t len = ref_encode_strips(&enc, img, out, out_size);
+			size_t w, h;
+			int comps;
+			int warnings = ref_decode(out, len, dec, &w, &h, &comps);
+			CHECK(!enc.overflow);
+			CHECK(warnings == 0);
+			CHECK(w == WIDTH && h == HEIGHT);
+			double psnr = ref_psnr(img, sampling, dec, comps);
+
+			uint8_t* ref = NULL;
+			size_t ref_len = ref_encode(img, sampling, q, &ref);
+			ref_decode(ref, ref_len, dec, &w, &h, &comps);
+			double ref_psnr_db = ref_psnr(img, sampling, dec, comps);
+			free(ref);
+			printf("%-6s q %3d: %6zu bytes %5.2f dB, libjpeg %6zu bytes "
+					"%5.2f dB\n", sampling_name(sampling), q, len, psnr,
+					ref_len, ref_psnr_db);
+			CHECK(fabs(psnr - ref_psnr_db) <= 1.0);
+		}
+	}
+}
+
+static void test_odd_size(const ref_image_t* img, uint8_t* out,
+		uint8_t* dec, jpeg_enc_sampling_t sampling, size_t w, size_t h) {
+	jpeg_encoder_t enc;
+	size_t dw, dh;
+	int comps;
+	jpeg_enc_init(&enc, w, h, sampling, 75);
+	// strips of the full image, the encoder reads the top left w x h
+	size_t len = ref_encode_strips(&enc, img, out, WIDTH * HEIGHT);
+	CHECK(!enc.overflow);
+	CHECK(ref_decode(out, len, dec, &dw, &dh, &comps) == 0);
+	CHECK(dw == w && dh == h);
+}
+
+static void test_overflow(const ref_image_t* img, uint8_t* out) {
+	jpeg_encoder_t enc;
+	jpeg_enc_init(&enc, WIDTH, HEIGHT, JPEG_ENC_GRAY, 90);
+	size_t len = ref_encode_strips(&enc, img, out, 1000);
+	CHECK(enc.overflow);
+	CHECK(len == 1000);
+}
+
+int main() {
+	ref_image_t img;
+	ref_image_init(&img, WIDTH, HEIGHT);
+	uint8_t* out = malloc(WIDTH * HEIGHT * 3);
+	uint8_t* dec = malloc(WIDTH * HEIGHT * 3);
+	test_quality(&img, out, dec);
+	test_odd_size(&img, out, dec, JPEG_ENC_GRAY, 50, 37);
+	test_odd_size(&img, out, dec, JPEG_ENC_YUV422, 102, 29);
+	test_odd_size(&img, out, dec, JPEG_ENC_YUV420, 100, 37);
+	test_overflow(&img, out);
+	ref_image_free(&img);
+	free(out);
+	free(dec);
+	if (s_failures != 0) {
+		printf("FAIL: %d checks\n", s_failures);
+		return 1;
+	}
+	printf("PASS\n");
+	return 0;
+}